@@ -0,0 +1,53 @@
+//
+//  archive.h
+//
+//  bounded hand over of finished meetings from the analytics thread to a writer thread that puts
+//  them on disk.  However slow the SD card is the analytics thread never waits for it - if the
+//  queue is full the meeting is dropped and counted
+//
+
+#ifndef archive_h
+#define archive_h
+
+#include <atomic>
+#include <time.h>
+
+#include "snapshot.h"
+
+// ARCHIVEQUEUE must be a power of two so the free running indexes can be masked
+#define ARCHIVEQUEUE 8
+
+typedef struct archive_entry{
+    char text[MAXPAYLOAD];
+    int length;
+    time_t ended;                       // wall clock time the meeting ended - it names the file
+    long long queued_us;                // monotonic time it was queued, for the wait metric
+ } archive_entry;
+
+typedef struct archive_queue{
+    archive_entry entry[ARCHIVEQUEUE];
+    alignas(64) std::atomic<unsigned int> head;       // next entry to fill - only the analytics thread stores to this
+    alignas(64) std::atomic<unsigned int> tail;       // next entry to write - only the writer stores to this
+    int wake_fd;                                      // eventfd the writer sleeps on
+    std::atomic<bool> stopping;
+    // metrics - each is only stored to by one side, and any thread may read them
+    alignas(64) std::atomic<unsigned long> queued;
+    std::atomic<unsigned long> dropped;               // meetings lost because the queue was full
+    std::atomic<unsigned int> high_water;             // deepest the queue has been
+    alignas(64) std::atomic<unsigned long> written;
+    std::atomic<unsigned long> failed;                // meetings the file system would not take
+    std::atomic<long long> last_write_us;             // open to close, including the fsync
+    std::atomic<long long> max_write_us;
+    std::atomic<long long> total_write_us;
+    std::atomic<long long> max_wait_us;               // longest a meeting sat in the queue before its write started
+ } archive_queue;
+
+bool archive_init(archive_queue *);
+void archive_close(archive_queue *);
+archive_entry * archive_entry_to_fill(archive_queue *);
+void archive_submit(archive_queue *);
+unsigned int archive_depth(archive_queue *);
+void archive_writer(archive_queue *);
+void archive_stop(archive_queue *);
+
+#endif /* archive_h */
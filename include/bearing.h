@@ -0,0 +1,20 @@
+//
+//  bearing.h
+//
+//  turns odas source positions into directions on meetpie's clock face, and elevations, without
+//  calling atan2
+//
+
+#ifndef bearing_h
+#define bearing_h
+
+#include "meetpie.h"
+
+#define DEGREES 57.29577951308232  // degrees in a radian
+#define BEARINGERROR 0.001         // most fast_direction and fast_elevation may be out by, in degrees - meetpie_bench checks it
+
+double fast_direction(double, double);
+double fast_elevation(double, double);
+void source_directions(const odas_data *, int, double *, double *, double *, double *, double *);
+
+#endif /* bearing_h */
@@ -0,0 +1,37 @@
+//
+//  clustering.h
+//
+//  online clustering of speaker directions.  Each participant is a small filtered track that
+//  follows the odas frames assigned to it; tracks that drift together are merged and one that is
+//  really covering two people is split
+//
+
+#ifndef clustering_h
+#define clustering_h
+
+#include "meetpie.h"
+
+// a frame goes to the most likely track within GATE, cut off at the meeting's angle_spread.  Tracks
+// closer than MERGEANGLE are one person, and a track whose two halves are more than SPLITANGLE apart is two
+#define MERGEANGLE 5
+#define SPLITANGLE 9
+#define SPLITFRAMES 100     // frames a track must have before it can be split
+#define SPLITSHARE 0.25     // and the smaller half must be getting at least this share of them
+#define CLUSTERRATE 0.05    // how fast the halves move towards a new frame
+
+// direction filter, all in degrees and frames
+#define DIRECTIONNOISE 3.0  // standard deviation of the direction odas reports
+#define ELEVATIONNOISE 2.0  // and of its elevation
+#define ELEVATIONDRIFT 0.05 // standard deviation of how far someone's elevation moves in a frame
+#define TURNNOISE 0.02      // standard deviation of how much someone's angular speed changes in a frame
+#define TURNDECAY 0.9       // angular speed kept from one frame to the next - people stop moving
+#define INITIALTURN 0.5     // standard deviation of the angular speed of someone just registered
+#define GATE 9.0            // a frame further than this squared number of standard deviations from a track is not theirs
+
+void cluster_predict(meeting *, participant_data *);
+int cluster_assign(const meeting *, const participant_data *, double, double);
+void cluster_update(meeting *, participant_data *, int, double, double, double, double, double);
+int cluster_prospect(meeting *, participant_data *, int, double, double, double, double, double);
+void cluster_maintain(meeting *, participant_data *);
+
+#endif /* clustering_h */
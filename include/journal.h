@@ -0,0 +1,121 @@
+//
+//  journal.h
+//
+//  append-only binary journal of the meeting state, one record per frame, so a meeting's whole
+//  timeline can be read back rather than only its final summary.  The analytics thread packs
+//  records into fixed size blocks and a writer thread puts each full block on disk exactly once.
+//  Readers mmap the file and find any meeting, or any time in one, with a binary search
+//
+
+#ifndef journal_h
+#define journal_h
+
+#include <atomic>
+#include <stdint.h>
+
+#include "meetpie.h"
+#include "payload.h"
+
+// the file is a header block and then JOURNALBLOCK byte blocks.  After every JOURNALINDEX data blocks comes an index
+// block listing where each of them starts, so a search only touches one page for each level it goes down
+#define JOURNALBLOCK 4096
+#define JOURNALINDEX 63
+#define JOURNALEXTENT 256       // blocks the file is grown by at a time, so appending rarely touches file system metadata
+#define JOURNALQUEUE 16         // full blocks waiting for the writer - a power of two
+#define JOURNALSYNC 16          // blocks written between fdatasyncs
+#define JOURNALMAGIC 0x314a504d // "MPJ1"
+#define JOURNALVERSION 1
+
+enum journal_block_kind{
+    JOURNAL_HEADER = 1,
+    JOURNAL_DATA,
+    JOURNAL_INDEX
+ };
+
+// at the start of every block.  A meeting never shares a block with another, and meeting_time only goes up within one
+typedef struct journal_block_header{
+    uint32_t magic;
+    uint16_t kind;
+    uint16_t records;
+    uint32_t used;                      // bytes of the block in use, this header included
+    uint32_t meeting;                   // meetings are numbered from 1 for the life of the journal
+    uint32_t first_time;                // meeting_time of the first record, or of the first block indexed
+    uint32_t sequence;                  // data blocks before this one, or before the first one indexed
+ } journal_block_header;
+
+// an index block's entries, one for each data block in its group
+typedef struct journal_index_entry{
+    uint32_t meeting;
+    uint32_t first_time;
+ } journal_index_entry;
+
+// each record is a length, the meeting's time and odas' timeStamp (little endian, unaligned) and then the meeting
+// state exactly as build_payload_raw lays it out
+#define JOURNALRECORDHEADER 10
+#define JOURNALRECORDSIZE (JOURNALRECORDHEADER + BINARYRAWSIZE)
+
+typedef struct journal_buffer{
+    alignas(64) unsigned char data[JOURNALBLOCK];
+    bool sync;                          // the last block of a meeting - written through to the card straight away
+ } journal_buffer;
+
+typedef struct journal_writer{
+    journal_buffer block[JOURNALQUEUE];
+    alignas(64) std::atomic<unsigned int> head;       // block being filled - only the analytics thread stores to this
+    alignas(64) std::atomic<unsigned int> tail;       // next block to write - only the writer stores to this
+    int fd;
+    int wake_fd;                        // eventfd the writer sleeps on
+    std::atomic<bool> stopping;
+    // analytics side
+    bool filling;                       // the block at head has records in it
+    bool meeting_open;                  // this meeting has recorded something, even if it was dropped
+    uint32_t meeting;
+    unsigned long records;
+    std::atomic<unsigned long> dropped;               // records lost because the writer was a whole queue behind
+    // writer side
+    unsigned long file_blocks;          // blocks in the file, header included
+    unsigned long allocated_blocks;     // blocks the file has room for
+    uint32_t data_blocks;
+    int unsynced;
+    bool broken;                        // a write failed, so nothing more is appended and the file stays a clean prefix
+    journal_index_entry index[JOURNALINDEX];
+    std::atomic<unsigned long> blocks_written;
+    std::atomic<unsigned long> failed;
+    std::atomic<long long> max_write_us;
+ } journal_writer;
+
+typedef struct journal_reader{
+    int fd;
+    const unsigned char *base;
+    unsigned long blocks;               // blocks actually written, header included - the rest is preallocated space
+ } journal_reader;
+
+// where a reader is - a block and a byte offset in it
+typedef struct journal_cursor{
+    unsigned long block;
+    uint32_t offset;
+ } journal_cursor;
+
+typedef struct journal_entry{
+    uint32_t meeting;
+    uint32_t meeting_time;
+    uint32_t time_stamp;
+    const unsigned char *state;         // build_payload_raw's layout
+    int length;
+ } journal_entry;
+
+bool journal_open_writer(journal_writer *, const char *);
+void journal_close_writer(journal_writer *);
+void journal_record(journal_writer *, const meeting *, const participant_data *);
+void journal_end_meeting(journal_writer *);
+void journal_write_queued(journal_writer *);
+void journal_writer_run(journal_writer *);
+void journal_stop(journal_writer *);
+
+bool journal_open(journal_reader *, const char *);
+void journal_close(journal_reader *);
+uint32_t journal_meetings(const journal_reader *);
+bool journal_seek(const journal_reader *, journal_cursor *, uint32_t, uint32_t);
+bool journal_next(const journal_reader *, journal_cursor *, journal_entry *);
+
+#endif /* journal_h */
@@ -16,8 +16,14 @@
 //extern "C" {
 //#endif
 
-void json_parse(char *, odas_data * );
+// both parsers have the same shape so the ingest path can be switched between them.  They fill in at most the
+// given number of sources and the frame's timeStamp, and return how many src items the datagram had.  A datagram
+// without a timeStamp leaves it as it was
+typedef int (*odas_parser)(char *, odas_data *, int, unsigned long *);
+
+int json_parse(char *, odas_data *, int, unsigned long *);
 void json_parse_item(json_object *, odas_data *, const int);
+int sst_parse(char *, odas_data *, int, unsigned long *);
 
 //#ifdef  __cplusplus
 //}
@@ -17,22 +17,32 @@
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <math.h>
+#include <limits.h>
 #include <time.h>
 
 #define INPORT 9000
 #define MAXLINE 1024
-#define MAXPART 8
-#define MAXSILENCE 500
-#define NUMCHANNELS 3
+#define MAXPART 8              // participants tracked unless -p asks for more
+#define MAXPOOL 24             // most -p can ask for - they all have to fit in one payload
+#define PARTICIPANTTIMEOUT 3000 // someone not heard for this many frames gives up their slot if it is needed
+#define NOPARTICIPANT -1
+#define MAXSILENCE 500         // these four are only defaults - see meeting_tuning
+#define MAXFRAMEGAP 50         // after a gap a frame stands for at most this many of the frames that were lost - longer is time nobody is credited with
+#define NUMCHANNELS 3          // odas sources assumed until -s says otherwise or the stream shows more
+#define MAXCHANNELS 8          // most odas sources there is room for
 #define ANGLESPREAD 15
 #define MINTURNSILENCE 30
-#define MINENERGY 0.2
-#define MINTALKTIME 3
-
-// to do :
-// define talker as the highest average energy over last 5 secs
-// interrupter is the other target if their energy is over 0.8
-// sucessful interrurpt is if they then take over as the strongest
+#define MINENERGY 0.2          // what meetpie2 gates activity on.  meetpie goes by position alone unless tuned to
+#define MINTALKTIME 2
+#define TALKERWINDOW 250
+#define INTERRUPTENERGY 0.8
+#define MAXEVENTS 4
+#define TICKMS 500
+#define MAXBATCH 16
+#define STATSTICKS 20
+#define PUBLISHHZ 5
+#define MAXUPDATEQUEUE 4
+#define ANGLERESOLUTION 10     // participants are kept in order of direction to this many steps a degree
 
 // function protos
 
@@ -40,31 +50,100 @@
 typedef struct odas_data{
     double x;
     double y;
+    double z;
     double activity;
     int frequency;
  } odas_data;
 
+// one parsed odas datagram - this is what the ingest thread hands to the analytics thread
+typedef struct odas_frame{
+    odas_data source[MAXCHANNELS];
+    int num_sources;                    // src items in the datagram, at most MAXCHANNELS
+    unsigned long time_stamp;           // odas' timeStamp, which goes up by one every frame
+ } odas_frame;
+
 typedef struct participant_data{
     int participant_angle;
     int participant_is_talking;
-    int participant_silent_time;
+    int participant_silent_time;        // frames of meeting time since they were last heard
     int participant_total_talk_time;
     int participant_num_turns;
     float participant_frequency;
+    int participant_energy;             // average activity over the talker window, in percent
+    int participant_interrupts_attempted;
+    int participant_interrupts_successful;
+    int participant_interrupting;       // non zero while an interruption by this participant is in progress
+    int participant_interrupt_quiet;    // frames of meeting time they have been quiet since it started
+    // where they sit - see clustering.cpp.  participant_frames is 0 while the slot is free
+    double participant_direction;       // filtered direction in degrees
+    double participant_turn;            // and how fast it is changing, in degrees a frame
+    double participant_variance[3];     // covariance of the two - direction, cross term, turn
+    double participant_elevation;       // filtered elevation in degrees, so someone standing is not whoever sits below them
+    double participant_elevation_variance;
+    double participant_x;               // direction and elevation as a unit vector
+    double participant_y;
+    double participant_z;
+    double participant_half_x[2];       // their frames split two ways, to spot two people sharing a track
+    double participant_half_y[2];
+    double participant_half_z[2];
+    double participant_half_share;      // recent share of their frames going to the first half
+    int participant_frames;
+    int participant_bearing;            // participant_direction in ANGLERESOLUTION steps
+    int participant_position;           // and where that puts them in the meeting's bearing_index
  } participant_data;
 
+// the thresholds a meeting is analysed with.  They start from the #defines and can be replaced by a config file at
+// startup (see tuning.cpp).  Every meeting has its own, so meetpie_tune can try many at once
+typedef struct meeting_tuning{
+    double min_energy;                  // activity a source needs to be heard at all - 0 goes by position alone
+    double angle_spread;                // furthest from someone's direction a frame can be and still be theirs, in degrees
+    int min_talk_time;                  // frames in a row that agree before someone new is registered
+    int max_silence;                    // frames of silence that end a meeting
+ } meeting_tuning;
+
+// Participants live in a pool of max_participants slots allocated with the meeting.  A participant's number is
+// their slot plus one; internally slots are used throughout and NOPARTICIPANT means nobody
 typedef struct meeting{
-    int participant_number[360];
-    int num_participants;
+    meeting_tuning tuning;              // starts new meetings unchanged
+    int max_participants;
+    int num_channels;                   // odas sources looked at in each frame
+    int num_participants;               // slots handed out so far - slots below this with participant_frames 0 are free
+    int participants_registered;        // goes up every time someone new is registered
+    // every duration is in frames of odas time, taken from the timeStamps rather than from how many frames reached us
     int total_silence;
     int total_meeting_time;
+    unsigned long time_stamp;           // of the last frame
+    int frame_elapsed;                  // frames of meeting time since the one before this
+    int frame_span;                     // and how many of them this frame is taken to stand for
+    unsigned long lost_frames;          // frames odas sent that never got here
+    int frame_gaps;                     // and the number of gaps they went missing in
     int last_talker;
     int num_talking;
+    // the talker is whoever has the highest average energy over the last TALKERWINDOW frames.  Each participant's
+    // activity for those frames is kept in thousandths so the running sums stay exact as samples come and go
+    short (*energy_window)[TALKERWINDOW];   // a row per slot
+    int *energy_sum;
+    int *frame_energy;                  // this frame's activity per slot, in thousandths
+    int window_position;
+    int dominant_talker;
+    // frames in a row each channel has heard from nobody we know, and the sum of their directions
+    int prospective_source[MAXCHANNELS];
+    double prospective_x[MAXCHANNELS];
+    double prospective_y[MAXCHANNELS];
+    double prospective_z[MAXCHANNELS];
+    // the slots in use sorted by participant_bearing, bearing_count of them
+    int *bearing_index;
+    int bearing_count;
  } meeting;
 
-void process_sound_data(meeting *, participant_data *, odas_data *);
+void process_sound_data(meeting *, participant_data *, odas_data *, unsigned long);
+bool meeting_is_over(const meeting *);
+void default_tuning(meeting_tuning *);
+bool allocate_meeting_data(meeting *, participant_data **, int);
+void free_meeting_data(meeting *, participant_data *);
 void initialise_meeting_data(meeting *, participant_data *, odas_data *);
-void write_to_file(char * ) ;
+void initialise_participant(participant_data *);
+void detect_interruptions(meeting *, participant_data *, const int *);
 
 
 #endif /* meetpie_h */
@@ -0,0 +1,32 @@
+//
+//  odas_ring.h
+//
+//  fixed size single producer / single consumer ring used to hand parsed odas
+//  frames from the ingest thread to the analytics thread without taking a lock
+//
+
+#ifndef odas_ring_h
+#define odas_ring_h
+
+#include <atomic>
+
+#include "meetpie.h"
+
+// RINGSIZE must be a power of two so the free running indexes can be masked
+#define RINGSIZE 256
+
+typedef struct odas_ring{
+    odas_frame frame[RINGSIZE];
+    alignas(64) std::atomic<unsigned int> head;       // next slot to write - only the producer stores to this
+    alignas(64) std::atomic<unsigned int> tail;       // next slot to read - only the consumer stores to this
+    alignas(64) std::atomic<unsigned long> pushed;
+    std::atomic<unsigned long> overflows;             // frames dropped because the consumer had fallen behind
+    std::atomic<unsigned int> high_water;             // largest occupancy seen by the producer
+ } odas_ring;
+
+void odas_ring_init(odas_ring *);
+bool odas_ring_push(odas_ring *, const odas_frame *);
+bool odas_ring_pop(odas_ring *, odas_frame *);
+unsigned int odas_ring_occupancy(odas_ring *);
+
+#endif /* odas_ring_h */
@@ -0,0 +1,60 @@
+//
+//  payload.h
+//
+//  builds what the "text/string" characteristic serves from the meeting state
+//
+
+#ifndef payload_h
+#define payload_h
+
+#include <string>
+
+#include "meetpie.h"
+
+// what text/string serves - json text is the default, clients can ask for the others through the data setter
+enum payload_format{
+    PAYLOAD_TEXT,
+    PAYLOAD_DELTA,
+    PAYLOAD_BINARY
+ };
+
+// first byte of every binary payload - bump it whenever the layout changes.  The binary form is lossy: talk time goes
+// as a 0-255 share of meeting time and energy in eighths, so a client gets both to within half a step of what the json
+// carries.  Ids, angles, talking, the dominant talker, turns and interrupts are exact
+#define BINARYSCHEMA 5
+// and of build_payload_raw's full precision layout, which the journal keeps
+#define RAWSCHEMA 4
+
+// most either layout can be before COBS - a raw participant needs at most 1 + 2 + 5 + 5 + 1 + 5 + 5 bytes, a binary
+// one 4 + 5 + 5 + 5
+#define BINARYRAWSIZE (3 + 5 + MAXPOOL * 24)
+
+// what one notification carries at the default ATT MTU of 23.  A binary payload fits in it for up to four participants
+// with turns under 7 and at most one interrupt each, in a meeting under 16384 frames.  Anything bigger - and MAXPART
+// allows eight - is longer than that, and a client on the default MTU has to read the rest of the value
+#define BINARYMTUVALUE 20
+
+// a full keyframe goes out at least this often in delta mode so late joiners can resync
+#define KEYFRAMEINTERVAL 100
+
+// what the last delta payload told clients, so the next one only needs what has changed since
+typedef struct payload_delta_state{
+    unsigned int version;
+    int publishes_since_keyframe;
+    bool force_keyframe;
+    int max_participants;
+    participant_data *published;        // a slot for every participant in the pool
+    int published_participants;         // meeting num_participants when they were published
+    int published_dominant_talker;
+ } payload_delta_state;
+
+void build_payload_string(std::string &, const meeting *, const participant_data *);
+int build_payload_text(char *, int, const meeting *, const participant_data *);
+bool payload_delta_init(payload_delta_state *, int);
+void payload_delta_free(payload_delta_state *);
+void payload_delta_reset(payload_delta_state *);
+int build_payload_delta(char *, int, payload_delta_state *, const meeting *, const participant_data *);
+int build_payload_raw(unsigned char *, const meeting *, const participant_data *);
+int build_payload_binary(char *, int, const meeting *, const participant_data *);
+
+#endif /* payload_h */
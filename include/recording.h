@@ -0,0 +1,76 @@
+//
+//  recording.h
+//
+//  raw capture of the odas datagrams meetpie receives, each with how long after the one before it
+//  arrived, so a session from the field can be replayed through the same parse and analytics later.
+//  The ingest thread only copies each datagram into a buffer; a writer thread puts full buffers on disk
+//
+
+#ifndef recording_h
+#define recording_h
+
+#include <atomic>
+#include <stdint.h>
+
+#include "meetpie.h"
+
+// the file starts with RECORDINGHEADER bytes - magic, version and the wall clock time recording started in microseconds.
+// Each frame after that is its length and the microseconds since the frame before (both little endian) and then the
+// datagram as it came off the socket
+#define RECORDINGMAGIC 0x3152504d     // "MPR1"
+#define RECORDINGVERSION 1
+#define RECORDINGHEADER 16
+#define RECORDINGFRAMEHEADER 6
+#define RECORDINGBUFFER 65536           // bytes handed to the writer at a time
+#define RECORDINGQUEUE 8                // buffers waiting for the writer - a power of two
+// meetpie_tune's labels sit beside the recordings they describe, as <recording>.label
+#define LABELSUFFIX ".label"
+#define RECORDINGFLUSHUS 1000000        // longest a datagram waits in a part filled buffer - the ingest thread checks
+                                        // every half of this even when odas goes quiet
+
+typedef struct recording_buffer{
+    unsigned char data[RECORDINGBUFFER];
+    int used;
+ } recording_buffer;
+
+typedef struct recording_writer{
+    recording_buffer buffer[RECORDINGQUEUE];
+    alignas(64) std::atomic<unsigned int> head;       // buffer being filled - only the ingest thread stores to this
+    alignas(64) std::atomic<unsigned int> tail;       // next buffer to write - only the writer stores to this
+    int fd;
+    int wake_fd;                        // eventfd the writer sleeps on
+    std::atomic<bool> stopping;
+    // ingest side
+    long long last_us;                  // when the last datagram arrived
+    long long filled_us;                // when the buffer at head got its first datagram
+    bool filling;                       // the buffer at head has datagrams in it
+    unsigned long frames;
+    unsigned long bytes;
+    std::atomic<unsigned long> dropped;               // datagrams lost because the writer was a whole queue behind
+    // writer side
+    std::atomic<unsigned long> failed;                // buffers the file system would not take
+    std::atomic<long long> max_write_us;
+ } recording_writer;
+
+typedef struct recording_reader{
+    int fd;
+    const unsigned char *base;
+    unsigned long size;
+    unsigned long offset;               // of the next frame
+    uint64_t started_us;                // wall clock time the recording started
+ } recording_reader;
+
+bool recording_open_writer(recording_writer *, const char *);
+void recording_close_writer(recording_writer *);
+void recording_add(recording_writer *, const char *, int);
+void recording_flush(recording_writer *);
+void recording_flush_due(recording_writer *);
+void recording_writer_run(recording_writer *);
+void recording_stop(recording_writer *);
+
+bool recording_sidecar(const char *);
+bool recording_open(recording_reader *, const char *);
+void recording_close(recording_reader *);
+bool recording_next(recording_reader *, const char **, int *, uint32_t *);
+
+#endif /* recording_h */
@@ -0,0 +1,32 @@
+//
+//  snapshot.h
+//
+//  triple buffered hand over of the payload from the analytics thread (the only writer) to the
+//  bluetooth server thread (the only reader).  Neither side ever waits for the other
+//
+
+#ifndef snapshot_h
+#define snapshot_h
+
+#include <atomic>
+
+#define MAXPAYLOAD 1024
+
+typedef struct payload_buffer{
+    char text[MAXPAYLOAD];
+    int length;
+ } payload_buffer;
+
+typedef struct payload_snapshot{
+    payload_buffer buffer[3];
+    std::atomic<int> middle;    // buffer most recently handed over, with SNAPSHOTFRESH set until the reader takes it
+    int back;                   // only touched by the writer
+    int front;                  // only touched by the reader
+ } payload_snapshot;
+
+void snapshot_init(payload_snapshot *);
+payload_buffer * snapshot_write_buffer(payload_snapshot *);
+void snapshot_publish(payload_snapshot *);
+const payload_buffer * snapshot_read(payload_snapshot *);
+
+#endif /* snapshot_h */
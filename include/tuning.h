@@ -0,0 +1,19 @@
+//
+//  tuning.h
+//
+//  reading and writing the config file that replaces the default meeting_tuning.  meetpie_tune
+//  writes it and meetpie, meetpie_batch and replays read it at startup
+//
+
+#ifndef tuning_h
+#define tuning_h
+
+#include "meetpie.h"
+
+// read from the working directory when no config file is named.  It not being there just means the defaults
+#define TUNINGFILE "meetpie.conf"
+
+int tuning_load(meeting_tuning *, const char *);
+bool tuning_save(const meeting_tuning *, const char *, const char *);
+
+#endif /* tuning_h */
@@ -0,0 +1,165 @@
+//
+//  archive.cpp
+//
+//  the meeting archive.  The analytics thread fills the entry at the head of a small spsc queue in
+//  place and moves head on; the writer thread sleeps on an eventfd until there is something to write,
+//  then writes, fsyncs and closes each meeting's MP_<epoch> file without holding anything the
+//  analytics or bluetooth threads need
+//
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <string>
+
+#include "../include/meetpie.h"
+#include "../include/archive.h"
+
+
+static long long monotonic_us()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+bool archive_init(archive_queue *archive)
+{
+	archive->head.store(0);
+	archive->tail.store(0);
+	archive->stopping.store(false);
+	archive->queued.store(0);
+	archive->dropped.store(0);
+	archive->high_water.store(0);
+	archive->written.store(0);
+	archive->failed.store(0);
+	archive->last_write_us.store(0);
+	archive->max_write_us.store(0);
+	archive->total_write_us.store(0);
+	archive->max_wait_us.store(0);
+
+	archive->wake_fd = eventfd(0, EFD_CLOEXEC);
+	return archive->wake_fd >= 0;
+}
+
+void archive_close(archive_queue *archive)
+{
+	close(archive->wake_fd);
+}
+
+// analytics side - the entry to build the next meeting in, or NULL (and counted) if the writer has fallen a whole
+// queue behind.  Nothing is queued until archive_submit
+archive_entry * archive_entry_to_fill(archive_queue *archive)
+{
+	unsigned int head = archive->head.load(std::memory_order_relaxed);
+
+	if (head - archive->tail.load(std::memory_order_acquire) >= ARCHIVEQUEUE)
+	{
+		archive->dropped.fetch_add(1, std::memory_order_relaxed);
+		return NULL;
+	}
+	return &archive->entry[head & (ARCHIVEQUEUE - 1)];
+}
+
+// analytics side - queues the entry archive_entry_to_fill gave out and wakes the writer
+void archive_submit(archive_queue *archive)
+{
+	unsigned int head = archive->head.load(std::memory_order_relaxed);
+	unsigned int depth = head + 1 - archive->tail.load(std::memory_order_acquire);
+	uint64_t wake = 1;
+
+	archive->entry[head & (ARCHIVEQUEUE - 1)].ended = time(NULL);
+	archive->entry[head & (ARCHIVEQUEUE - 1)].queued_us = monotonic_us();
+	archive->head.store(head + 1, std::memory_order_release);
+
+	archive->queued.fetch_add(1, std::memory_order_relaxed);
+	if (depth > archive->high_water.load(std::memory_order_relaxed))
+	{
+		archive->high_water.store(depth, std::memory_order_relaxed);
+	}
+	write(archive->wake_fd, &wake, sizeof(wake));
+}
+
+// safe to call from any thread - the answer is only a snapshot
+unsigned int archive_depth(archive_queue *archive)
+{
+	return archive->head.load(std::memory_order_acquire) - archive->tail.load(std::memory_order_acquire);
+}
+
+// the blocking part - this is the only place meetpie waits on storage
+static bool write_archive_file(const archive_entry *entry)
+{
+	std::string filename = "MP_" + std::to_string(entry->ended);
+	int fd, written = 0, bytes;
+	bool ok;
+
+	// a summary that could not be built leaves no empty archive behind
+	if (entry->length < 0 || (fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0)
+	{
+		return false;
+	}
+	while (written < entry->length && (bytes = write(fd, entry->text + written, entry->length - written)) > 0)
+	{
+		written += bytes;
+	}
+	ok = written == entry->length && fsync(fd) == 0;
+	return close(fd) == 0 && ok;
+}
+
+// the writer thread.  It writes everything queued, then sleeps until it is woken again.  Once stopped it still writes
+// whatever was queued before returning, so no finished meeting is lost on the way out
+void archive_writer(archive_queue *archive)
+{
+	unsigned int tail;
+	uint64_t wakes;
+	long long start, wait, elapsed;
+	archive_entry *entry;
+
+	for (;;)
+	{
+		while ((tail = archive->tail.load(std::memory_order_relaxed)) != archive->head.load(std::memory_order_acquire))
+		{
+			entry = &archive->entry[tail & (ARCHIVEQUEUE - 1)];
+			start = monotonic_us();
+			wait = start - entry->queued_us;
+
+			if (write_archive_file(entry))
+			{
+				archive->written.fetch_add(1, std::memory_order_relaxed);
+			}
+			else
+			{
+				archive->failed.fetch_add(1, std::memory_order_relaxed);
+			}
+			archive->tail.store(tail + 1, std::memory_order_release);
+
+			elapsed = monotonic_us() - start;
+			archive->last_write_us.store(elapsed, std::memory_order_relaxed);
+			archive->total_write_us.fetch_add(elapsed, std::memory_order_relaxed);
+			if (elapsed > archive->max_write_us.load(std::memory_order_relaxed))
+			{
+				archive->max_write_us.store(elapsed, std::memory_order_relaxed);
+			}
+			if (wait > archive->max_wait_us.load(std::memory_order_relaxed))
+			{
+				archive->max_wait_us.store(wait, std::memory_order_relaxed);
+			}
+		}
+
+		if (archive->stopping.load(std::memory_order_acquire))
+		{
+			return;
+		}
+		read(archive->wake_fd, &wakes, sizeof(wakes));
+	}
+}
+
+// any thread - the writer finishes what is queued and returns
+void archive_stop(archive_queue *archive)
+{
+	uint64_t wake = 1;
+
+	archive->stopping.store(true, std::memory_order_release);
+	write(archive->wake_fd, &wake, sizeof(wake));
+}
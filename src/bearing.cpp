@@ -0,0 +1,73 @@
+//
+//  bearing.cpp
+//
+//  direction of (x, y) in degrees, 180 - atan2(x, y) as meetpie has always measured it, wrapped
+//  into [0,360), and elevation above the horizontal in degrees.  The angle is folded into the
+//  first octant, where an odd polynomial gives atan to within 1e-5 radians, and unfolded again
+//  with selects rather than branches so a loop over every channel in a frame compiles to straight
+//  line code the compiler can vectorise
+//
+
+#include "../include/bearing.h"
+
+// minimax fit of atan(t) / t in t * t over [0,1]
+static const double atan_c1 = 0.99997726;
+static const double atan_c3 = -0.33262347;
+static const double atan_c5 = 0.19354346;
+static const double atan_c7 = -0.11643287;
+static const double atan_c9 = 0.05265332;
+static const double atan_c11 = -0.01172120;
+
+
+// atan2(a, b) for a and b both at least 0, in radians
+static inline double octant_atan(double a, double b)
+{
+	double big = a > b ? a : b;
+	double small = a > b ? b : a;
+	double t = big > 0.0 ? small / big : 0.0;
+	double t2 = t * t;
+	double angle = t * (atan_c1 + t2 * (atan_c3 + t2 * (atan_c5 + t2 * (atan_c7 + t2 * (atan_c9 + t2 * atan_c11)))));
+
+	return a > b ? M_PI_2 - angle : angle;
+}
+
+double fast_direction(double x, double y)
+{
+	double angle = octant_atan(fabs(x), fabs(y));
+	double direction;
+
+	// back out of the quadrant to atan2(x, y), then round the clock face
+	angle = y < 0.0 ? M_PI - angle : angle;
+	angle = x < 0.0 ? -angle : angle;
+
+	direction = 180.0 - angle * DEGREES;
+	direction = direction >= 360.0 ? direction - 360.0 : direction;
+	return direction < 0.0 ? direction + 360.0 : direction;
+}
+
+// elevation in degrees of something horizontal away across the floor and z above it, [-90,90]
+double fast_elevation(double horizontal, double z)
+{
+	double angle = octant_atan(fabs(z), horizontal) * DEGREES;
+
+	return z < 0.0 ? -angle : angle;
+}
+
+// the direction and elevation of each of a frame's sources, and where they point as a unit vector.  Silent sources
+// (x, y and z all 0) come out as (0, 0, 0) pointing at 180 - callers are expected to skip them as they always have
+void source_directions(const odas_data *odas_data_array, int num_sources, double *x, double *y, double *z, double *direction, double *elevation)
+{
+	int i;
+	double length;
+
+	for (i = 0; i < num_sources; i++)
+	{
+		length = sqrt(odas_data_array[i].x * odas_data_array[i].x + odas_data_array[i].y * odas_data_array[i].y + odas_data_array[i].z * odas_data_array[i].z);
+		length = length > 0.0 ? 1.0 / length : 0.0;
+		x[i] = odas_data_array[i].x * length;
+		y[i] = odas_data_array[i].y * length;
+		z[i] = odas_data_array[i].z * length;
+		direction[i] = fast_direction(x[i], y[i]);
+		elevation[i] = fast_elevation(sqrt(x[i] * x[i] + y[i] * y[i]), z[i]);
+	}
+}
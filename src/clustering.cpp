@@ -0,0 +1,624 @@
+//
+//  clustering.cpp
+//
+//  tracks where each participant is sitting.  Every participant carries a constant velocity filter
+//  on their direction - an angle, an angular speed and the 2x2 covariance of the two - which is
+//  predicted on once a frame and corrected by every odas frame assigned to them.  A frame goes to
+//  the participant it is most likely to have come from, as long as it falls inside that
+//  participant's gate, so a noisy frame that fits nobody is left alone rather than misattributed.
+//  The work per frame is fixed by the number of channels and participants.
+//
+//  Elevation has a filter of its own, a position that drifts slowly, and a frame has to fit both
+//  to be someone's.  That is what keeps a presenter standing behind someone seated apart from them
+//  when odas hears both at the same bearing.
+//
+//  A participant's direction and elevation are also kept as a unit vector, which makes merging
+//  and splitting wrap round the clock face without special cases and means both of them only ever
+//  go by how far apart people really are, whichever way that is.  Every participant runs a two way split of
+//  their own frames; one person's frames keep the two halves close together, two people sharing a
+//  track pull them apart, and once they are further apart than SPLITANGLE the track becomes two
+//
+//  Participants are found by direction rather than by looking at everyone.  The meeting keeps the
+//  slots in use sorted by direction to 1/ANGLERESOLUTION of a degree, so the people near a frame
+//  are a binary search and a short walk away, and nobody further round than the meeting's
+//  angle_spread is looked at.  Someone's direction only moves a little each frame, so
+//  keeping the order is usually a comparison with their neighbours.  The index is as long as the
+//  number of people, not the number of steps round the clock face, so starting a new meeting
+//  just empties it
+//
+
+#include "../include/clustering.h"
+#include "../include/bearing.h"
+
+static const double merge_cos = cos(MERGEANGLE / DEGREES);
+static const double split_cos = cos(SPLITANGLE / DEGREES);
+
+// halves start this far either side of the track
+static const double half_cos = cos(SPLITANGLE / 4 / DEGREES);
+static const double half_sin = sin(SPLITANGLE / 4 / DEGREES);
+
+static const double measurement_variance = DIRECTIONNOISE * DIRECTIONNOISE;
+static const double turn_variance = TURNNOISE * TURNNOISE;
+static const double elevation_measurement_variance = ELEVATIONNOISE * ELEVATIONNOISE;
+static const double elevation_drift_variance = ELEVATIONDRIFT * ELEVATIONDRIFT;
+
+static const int bearing_steps = 360 * ANGLERESOLUTION;
+
+// however long someone has been quiet we never trust where we think they are less than a single frame.  That stops
+// one stray frame moving them more than half way to it, and as the gate is sqrt(GATE * innovation variance) wide it
+// keeps the gate inside the default angle_spread
+static const double max_direction_variance = DIRECTIONNOISE * DIRECTIONNOISE;
+
+
+// signed difference between two directions, wrapped into [-180,180)
+static double direction_difference(double to, double from)
+{
+	double difference = to - from;
+
+	if (difference >= 180.0)
+	{
+		difference -= 360.0;
+	}
+	else if (difference < -180.0)
+	{
+		difference += 360.0;
+	}
+	return difference;
+}
+
+// a direction in degrees as a step round the clock face, [0,bearing_steps)
+static int direction_bearing(double direction)
+{
+	int bearing = direction * ANGLERESOLUTION + 0.5;
+
+	return bearing < bearing_steps ? bearing : bearing - bearing_steps;
+}
+
+static void index_place(meeting *meeting_data, participant_data *participant_data_array, int position, int slot)
+{
+	meeting_data->bearing_index[position] = slot;
+	participant_data_array[slot].participant_position = position;
+}
+
+// the first position in the index at or after bearing - bearing_count if everyone is before it
+static int index_search(const meeting *meeting_data, const participant_data *participant_data_array, int bearing)
+{
+	int low = 0, high = meeting_data->bearing_count, middle;
+
+	while (low < high)
+	{
+		middle = (low + high) / 2;
+		if (participant_data_array[meeting_data->bearing_index[middle]].participant_bearing < bearing)
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+	return low;
+}
+
+// the run of the index within spread degrees of a direction, wrapping round past 360.  Sets *position to where it
+// starts and returns how many are in it - entry k of the run is at (*position + k) % bearing_count
+static int index_window(const meeting *meeting_data, const participant_data *participant_data_array, double direction, double spread, int *position)
+{
+	int width = 2 * (int)(spread * ANGLERESOLUTION + 0.5);
+	int low = direction_bearing(direction) - width / 2;
+	int count, distance;
+
+	if (meeting_data->bearing_count == 0)
+	{
+		*position = 0;
+		return 0;
+	}
+	low = low < 0 ? low + bearing_steps : low;
+	*position = index_search(meeting_data, participant_data_array, low) % meeting_data->bearing_count;
+
+	for (count = 0; count < meeting_data->bearing_count; count++)
+	{
+		distance = participant_data_array[meeting_data->bearing_index[(*position + count) % meeting_data->bearing_count]].participant_bearing - low;
+		distance = distance < 0 ? distance + bearing_steps : distance;
+		if (distance > width)
+		{
+			break;
+		}
+	}
+	return count;
+}
+
+// lists a slot at its participant_bearing
+static void index_insert(meeting *meeting_data, participant_data *participant_data_array, int slot)
+{
+	int insert = index_search(meeting_data, participant_data_array, participant_data_array[slot].participant_bearing);
+	int position;
+
+	for (position = meeting_data->bearing_count++; position > insert; position--)
+	{
+		index_place(meeting_data, participant_data_array, position, meeting_data->bearing_index[position - 1]);
+	}
+	index_place(meeting_data, participant_data_array, insert, slot);
+}
+
+static void index_remove(meeting *meeting_data, participant_data *participant_data_array, int slot)
+{
+	int position;
+
+	for (position = participant_data_array[slot].participant_position + 1; position < meeting_data->bearing_count; position++)
+	{
+		index_place(meeting_data, participant_data_array, position - 1, meeting_data->bearing_index[position]);
+	}
+	--meeting_data->bearing_count;
+}
+
+// moves a listed slot to a new bearing.  People do not move far in a frame so this is normally no more than a swap
+// with a neighbour - only wrapping past 360 takes them from one end of the index to the other
+static void index_move(meeting *meeting_data, participant_data *participant_data_array, int slot, int bearing)
+{
+	int position = participant_data_array[slot].participant_position;
+	int *index = meeting_data->bearing_index;
+
+	participant_data_array[slot].participant_bearing = bearing;
+	while (position > 0 && participant_data_array[index[position - 1]].participant_bearing > bearing)
+	{
+		index_place(meeting_data, participant_data_array, position, index[position - 1]);
+		index_place(meeting_data, participant_data_array, --position, slot);
+	}
+	while (position < meeting_data->bearing_count - 1 && participant_data_array[index[position + 1]].participant_bearing < bearing)
+	{
+		index_place(meeting_data, participant_data_array, position, index[position + 1]);
+		index_place(meeting_data, participant_data_array, ++position, slot);
+	}
+}
+
+// points a participant at a direction and elevation in degrees, keeping the unit vector, published angle and index in step
+static void set_direction(meeting *meeting_data, participant_data *participant_data_array, int slot, double direction, double elevation)
+{
+	participant_data *participant = &participant_data_array[slot];
+	double horizontal = cos(elevation / DEGREES);
+	int bearing;
+
+	// a direction a hair below zero wraps to exactly 360.0 once rounded, so it is brought back into [0,360) afterwards
+	direction = fmod(direction, 360.0);
+	if (direction < 0.0)
+	{
+		direction += 360.0;
+	}
+	if (direction >= 360.0)
+	{
+		direction = 0.0;
+	}
+	participant->participant_direction = direction;
+	participant->participant_elevation = elevation;
+	participant->participant_x = horizontal * sin((180.0 - direction) / DEGREES);
+	participant->participant_y = horizontal * cos((180.0 - direction) / DEGREES);
+	participant->participant_z = sin(elevation / DEGREES);
+	participant->participant_angle = direction;
+
+	bearing = direction_bearing(direction);
+	if (bearing != participant->participant_bearing)
+	{
+		index_move(meeting_data, participant_data_array, slot, bearing);
+	}
+}
+
+// moves a unit vector part of the way towards another and puts it back on the unit sphere
+static void move_towards(double *x, double *y, double *z, double target_x, double target_y, double target_z, double rate)
+{
+	double length;
+
+	*x += rate * (target_x - *x);
+	*y += rate * (target_y - *y);
+	*z += rate * (target_z - *z);
+	length = sqrt(*x * *x + *y * *y + *z * *z);
+	if (length > 0.0)
+	{
+		*x /= length;
+		*y /= length;
+		*z /= length;
+	}
+}
+
+// the elevation of a vector that need not be a unit one
+static double vector_elevation(double x, double y, double z)
+{
+	return fast_elevation(sqrt(x * x + y * y), z);
+}
+
+static void reset_halves(participant_data *participant)
+{
+	double x = participant->participant_x;
+	double y = participant->participant_y;
+
+	participant->participant_half_x[0] = x * half_cos - y * half_sin;
+	participant->participant_half_y[0] = x * half_sin + y * half_cos;
+	participant->participant_half_x[1] = x * half_cos + y * half_sin;
+	participant->participant_half_y[1] = y * half_cos - x * half_sin;
+	participant->participant_half_z[0] = participant->participant_half_z[1] = participant->participant_z;
+	participant->participant_half_share = 0.5;
+}
+
+// starts a participant's filter at a direction known to within the given variance, and an elevation known as well as
+// the same number of frames would tell us, not moving
+static void reset_filter(meeting *meeting_data, participant_data *participant_data_array, int slot, double direction, double elevation, double variance)
+{
+	participant_data *participant = &participant_data_array[slot];
+
+	set_direction(meeting_data, participant_data_array, slot, direction, elevation);
+	participant->participant_turn = 0.0;
+	participant->participant_variance[0] = variance;
+	participant->participant_variance[1] = 0.0;
+	participant->participant_variance[2] = INITIALTURN * INITIALTURN;
+	participant->participant_elevation_variance = variance * elevation_measurement_variance / measurement_variance;
+	reset_halves(participant);
+}
+
+// empties a slot, leaving nobody pointing at it
+static void free_slot(meeting *meeting_data, participant_data *participant_data_array, int slot)
+{
+	index_remove(meeting_data, participant_data_array, slot);
+	memset(meeting_data->energy_window[slot], 0, sizeof(meeting_data->energy_window[slot]));
+	meeting_data->energy_sum[slot] = 0;
+	meeting_data->frame_energy[slot] = 0;
+
+	if (meeting_data->last_talker == slot)
+	{
+		meeting_data->last_talker = NOPARTICIPANT;
+	}
+	if (meeting_data->dominant_talker == slot)
+	{
+		meeting_data->dominant_talker = NOPARTICIPANT;
+	}
+
+	initialise_participant(&participant_data_array[slot]);
+}
+
+// a free slot, else a new one while the pool lasts, else the slot of whoever has been quiet longest as long as that is
+// more than PARTICIPANTTIMEOUT frames.  Returns NOPARTICIPANT if there is none of those
+static int find_slot(meeting *meeting_data, participant_data *participant_data_array)
+{
+	int i, stalest = NOPARTICIPANT;
+
+	for (i = 0; i < meeting_data->num_participants; i++)
+	{
+		if (participant_data_array[i].participant_frames == 0)
+		{
+			return i;
+		}
+		if (participant_data_array[i].participant_silent_time > PARTICIPANTTIMEOUT &&
+			(stalest == NOPARTICIPANT || participant_data_array[i].participant_silent_time > participant_data_array[stalest].participant_silent_time))
+		{
+			stalest = i;
+		}
+	}
+	if (meeting_data->num_participants < meeting_data->max_participants)
+	{
+		return meeting_data->num_participants++;
+	}
+	if (stalest != NOPARTICIPANT)
+	{
+		free_slot(meeting_data, participant_data_array, stalest);
+	}
+	return stalest;
+}
+
+// starts someone new at a direction in the first slot find_slot gives us - returns NOPARTICIPANT if the pool is full
+static int take_slot(meeting *meeting_data, participant_data *participant_data_array, double direction, double elevation, double variance)
+{
+	int slot = find_slot(meeting_data, participant_data_array);
+
+	if (slot == NOPARTICIPANT)
+	{
+		return NOPARTICIPANT;
+	}
+
+	participant_data_array[slot].participant_bearing = direction_bearing(direction);
+	index_insert(meeting_data, participant_data_array, slot);
+	reset_filter(meeting_data, participant_data_array, slot, direction, elevation, variance);
+	participant_data_array[slot].participant_frequency = 200.0;
+	meeting_data->frame_energy[slot] = 0;
+	++meeting_data->participants_registered;
+	return slot;
+}
+
+// moves every participant's filter on by the frames of meeting time since the last one.  Their angular speed dies
+// away, and the less recently they have been heard the less sure we are of where they are, up to the widest gate we
+// allow.  After a gap the filter runs on for at most MAXFRAMEGAP frames, by which time it has settled anyway
+void cluster_predict(meeting *meeting_data, participant_data *participant_data_array)
+{
+	int i, step, steps = meeting_data->frame_span;
+	double *variance, scale, direction;
+	participant_data *participant;
+
+	for (i = 0; i < meeting_data->num_participants; i++)
+	{
+		participant = &participant_data_array[i];
+		if (participant->participant_frames == 0)
+		{
+			continue;
+		}
+		participant->participant_silent_time += meeting_data->frame_elapsed;
+
+		if (participant->participant_turn != 0.0)
+		{
+			direction = participant->participant_direction;
+			for (step = 0; step < steps; step++)
+			{
+				direction += participant->participant_turn;
+				participant->participant_turn *= TURNDECAY;
+			}
+			set_direction(meeting_data, participant_data_array, i, direction, participant->participant_elevation);
+		}
+
+		// P = F P F' + Q with F = [1 1; 0 TURNDECAY] and Q for a random change of speed once a frame
+		variance = participant->participant_variance;
+		for (step = 0; step < steps; step++)
+		{
+			variance[0] += 2.0 * variance[1] + variance[2] + turn_variance / 4.0;
+			variance[1] = TURNDECAY * (variance[1] + variance[2]) + turn_variance / 2.0;
+			variance[2] = TURNDECAY * TURNDECAY * variance[2] + turn_variance;
+		}
+
+		if (variance[0] > max_direction_variance)
+		{
+			scale = sqrt(max_direction_variance / variance[0]);
+			variance[0] = max_direction_variance;
+			variance[1] *= scale;
+		}
+
+		participant->participant_elevation_variance += steps * elevation_drift_variance;
+		if (participant->participant_elevation_variance > elevation_measurement_variance)
+		{
+			participant->participant_elevation_variance = elevation_measurement_variance;
+		}
+	}
+}
+
+// the participant a frame from this direction and elevation most likely came from, or NOPARTICIPANT if it is outside
+// everyone's gate
+int cluster_assign(const meeting *meeting_data, const participant_data *participant_data_array, double direction, double elevation)
+{
+	int position, count, i, slot, nearest = NOPARTICIPANT;
+	double innovation, innovation_variance, distance, cost, nearest_cost = 0.0;
+	double elevation_innovation, elevation_innovation_variance;
+
+	count = index_window(meeting_data, participant_data_array, direction, meeting_data->tuning.angle_spread, &position);
+	for (i = 0; i < count; i++)
+	{
+		slot = meeting_data->bearing_index[(position + i) % meeting_data->bearing_count];
+		innovation = direction_difference(direction, participant_data_array[slot].participant_direction);
+		innovation_variance = participant_data_array[slot].participant_variance[0] + measurement_variance;
+		elevation_innovation = elevation - participant_data_array[slot].participant_elevation;
+		elevation_innovation_variance = participant_data_array[slot].participant_elevation_variance + elevation_measurement_variance;
+		distance = innovation * innovation / innovation_variance + elevation_innovation * elevation_innovation / elevation_innovation_variance;
+		if (distance > GATE)
+		{
+			continue;
+		}
+
+		// negative log likelihood, less the constant every participant shares
+		cost = distance + log(innovation_variance * elevation_innovation_variance);
+		if (nearest == NOPARTICIPANT || cost < nearest_cost)
+		{
+			nearest_cost = cost;
+			nearest = slot;
+		}
+	}
+	return nearest;
+}
+
+// corrects a participant's filter with a frame assigned to them, and moves the nearer of their halves towards it.
+// (x, y, z) is the frame's direction as a unit vector
+void cluster_update(meeting *meeting_data, participant_data *participant_data_array, int slot, double direction, double elevation,
+					double x, double y, double z)
+{
+	participant_data *participant = &participant_data_array[slot];
+	double *variance = participant->participant_variance;
+	double innovation = direction_difference(direction, participant->participant_direction);
+	double innovation_variance = variance[0] + measurement_variance;
+	double gain_direction = variance[0] / innovation_variance;
+	double gain_turn = variance[1] / innovation_variance;
+	double gain_elevation = participant->participant_elevation_variance / (participant->participant_elevation_variance + elevation_measurement_variance);
+	int half;
+
+	++participant->participant_frames;
+	participant->participant_silent_time = 0;
+	participant->participant_turn += gain_turn * innovation;
+	set_direction(meeting_data, participant_data_array, slot, participant->participant_direction + gain_direction * innovation,
+				  participant->participant_elevation + gain_elevation * (elevation - participant->participant_elevation));
+
+	variance[2] -= gain_turn * variance[1];
+	variance[0] *= 1.0 - gain_direction;
+	variance[1] *= 1.0 - gain_direction;
+	participant->participant_elevation_variance *= 1.0 - gain_elevation;
+
+	half = (x * participant->participant_half_x[0] + y * participant->participant_half_y[0] + z * participant->participant_half_z[0]) <
+		   (x * participant->participant_half_x[1] + y * participant->participant_half_y[1] + z * participant->participant_half_z[1]);
+	move_towards(&participant->participant_half_x[half], &participant->participant_half_y[half], &participant->participant_half_z[half],
+				 x, y, z, CLUSTERRATE);
+	participant->participant_half_share += CLUSTERRATE * ((half == 0) - participant->participant_half_share);
+}
+
+// a frame on channel iChannel that nobody's gate took.  Once the channel has heard min_talk_time more frames in a row
+// that agree with each other we are more certain it is a new member, and register them where those frames came
+// from.  Returns their slot, or NOPARTICIPANT if nobody was registered
+int cluster_prospect(meeting *meeting_data, participant_data *participant_data_array, int iChannel, double direction, double elevation,
+					 double x, double y, double z)
+{
+	int count = meeting_data->prospective_source[iChannel];
+	double mean_x = meeting_data->prospective_x[iChannel];
+	double mean_y = meeting_data->prospective_y[iChannel];
+	double mean_z = meeting_data->prospective_z[iChannel];
+	double innovation, elevation_innovation;
+	int number;
+
+	// a frame that does not fit with the ones before it starts the count again - this is what stops noise turning into people
+	if (count > 0)
+	{
+		innovation = direction_difference(direction, fast_direction(mean_x, mean_y));
+		elevation_innovation = elevation - vector_elevation(mean_x, mean_y, mean_z);
+		if (innovation * innovation / (measurement_variance + measurement_variance / count) +
+			elevation_innovation * elevation_innovation / (elevation_measurement_variance + elevation_measurement_variance / count) > GATE)
+		{
+			count = 0;
+			mean_x = mean_y = mean_z = 0.0;
+		}
+	}
+
+	meeting_data->prospective_source[iChannel] = ++count;
+	meeting_data->prospective_x[iChannel] = mean_x + x;
+	meeting_data->prospective_y[iChannel] = mean_y + y;
+	meeting_data->prospective_z[iChannel] = mean_z + z;
+	if (count <= meeting_data->tuning.min_talk_time)
+	{
+		return NOPARTICIPANT;
+	}
+
+	mean_x = meeting_data->prospective_x[iChannel];
+	mean_y = meeting_data->prospective_y[iChannel];
+	mean_z = meeting_data->prospective_z[iChannel];
+	number = take_slot(meeting_data, participant_data_array, fast_direction(mean_x, mean_y), vector_elevation(mean_x, mean_y, mean_z),
+					   measurement_variance / count);
+	if (number != NOPARTICIPANT)
+	{
+		participant_data_array[number].participant_frames = count;
+	}
+	meeting_data->prospective_source[iChannel] = 0;
+	meeting_data->prospective_x[iChannel] = 0.0;
+	meeting_data->prospective_y[iChannel] = 0.0;
+	meeting_data->prospective_z[iChannel] = 0.0;
+	return number;
+}
+
+// folds participant j into participant i and frees j's slot
+static void merge_participants(meeting *meeting_data, participant_data *participant_data_array, int i, int j)
+{
+	int *frame_energy = meeting_data->frame_energy;
+	participant_data *keep = &participant_data_array[i];
+	participant_data *gone = &participant_data_array[j];
+	double frames = keep->participant_frames + gone->participant_frames;
+	double x = keep->participant_x, y = keep->participant_y, z = keep->participant_z;
+	double variance = keep->participant_variance[0];
+	int position;
+
+	move_towards(&x, &y, &z, gone->participant_x, gone->participant_y, gone->participant_z, gone->participant_frames / frames);
+	if (gone->participant_variance[0] < variance)
+	{
+		variance = gone->participant_variance[0];
+	}
+	reset_filter(meeting_data, participant_data_array, i, fast_direction(x, y), vector_elevation(x, y, z), variance);
+	keep->participant_frames += gone->participant_frames;
+
+	keep->participant_is_talking |= gone->participant_is_talking;
+	keep->participant_total_talk_time += gone->participant_total_talk_time;
+	keep->participant_num_turns += gone->participant_num_turns;
+	keep->participant_interrupts_attempted += gone->participant_interrupts_attempted;
+	keep->participant_interrupts_successful += gone->participant_interrupts_successful;
+
+	if (frame_energy[j] > frame_energy[i])
+	{
+		frame_energy[i] = frame_energy[j];
+	}
+	for (position = 0; position < TALKERWINDOW; position++)
+	{
+		meeting_data->energy_window[i][position] += meeting_data->energy_window[j][position];
+	}
+	meeting_data->energy_sum[i] += meeting_data->energy_sum[j];
+
+	if (meeting_data->last_talker == j)
+	{
+		meeting_data->last_talker = i;
+	}
+	if (meeting_data->dominant_talker == j)
+	{
+		meeting_data->dominant_talker = i;
+	}
+
+	free_slot(meeting_data, participant_data_array, j);
+}
+
+// splits off the second half of participant i as a new participant, if there is room for one
+static void split_participant(meeting *meeting_data, participant_data *participant_data_array, int i)
+{
+	participant_data *participant = &participant_data_array[i];
+	int j = take_slot(meeting_data, participant_data_array,
+					  fast_direction(participant->participant_half_x[1], participant->participant_half_y[1]),
+					  vector_elevation(participant->participant_half_x[1], participant->participant_half_y[1], participant->participant_half_z[1]),
+					  participant->participant_variance[0]);
+
+	if (j == NOPARTICIPANT)
+	{
+		return;
+	}
+
+	// nobody can say which of them the history so far belongs to, so it stays with the original participant
+	participant_data_array[j].participant_frames = participant->participant_frames * (1.0 - participant->participant_half_share);
+	participant->participant_frames -= participant_data_array[j].participant_frames;
+	reset_filter(meeting_data, participant_data_array, i,
+				 fast_direction(participant->participant_half_x[0], participant->participant_half_y[0]),
+				 vector_elevation(participant->participant_half_x[0], participant->participant_half_y[0], participant->participant_half_z[0]),
+				 participant->participant_variance[0]);
+}
+
+// merges and splits the participants heard this frame.  Only they have moved, so nobody else needs looking at, and
+// anyone close enough to merge with them is a short walk either side of them in the index
+void cluster_maintain(meeting *meeting_data, participant_data *participant_data_array)
+{
+	int i, j, k, position, count;
+	bool merged;
+	double horizontal, merge_spread;
+	participant_data *participant, *other;
+
+	for (i = 0; i < meeting_data->num_participants; i++)
+	{
+		participant = &participant_data_array[i];
+		if (participant->participant_is_talking == 0 || participant->participant_frames == 0)
+		{
+			continue;
+		}
+
+		// MERGEANGLE is measured on the sphere, so above or below someone it spans more of the clock face
+		horizontal = sqrt(participant->participant_x * participant->participant_x + participant->participant_y * participant->participant_y);
+		merge_spread = horizontal * 180.0 > MERGEANGLE ? MERGEANGLE / horizontal + 1 : 180.0;
+
+		// merging moves people round the index, so after each one look again from the start
+		do
+		{
+			merged = false;
+			count = index_window(meeting_data, participant_data_array, participant->participant_direction, merge_spread, &position);
+			for (k = 0; k < count; k++)
+			{
+				j = meeting_data->bearing_index[(position + k) % meeting_data->bearing_count];
+				other = &participant_data_array[j];
+				if (j == i || participant->participant_x * other->participant_x + participant->participant_y * other->participant_y +
+							  participant->participant_z * other->participant_z <= merge_cos)
+				{
+					continue;
+				}
+
+				// the one with more history keeps their number
+				if (other->participant_frames > participant->participant_frames)
+				{
+					merge_participants(meeting_data, participant_data_array, j, i);
+					break;
+				}
+				merge_participants(meeting_data, participant_data_array, i, j);
+				merged = true;
+				break;
+			}
+		} while (merged);
+		if (participant->participant_frames == 0)
+		{
+			continue;
+		}
+
+		if (participant->participant_frames > SPLITFRAMES &&
+			participant->participant_half_share > SPLITSHARE && participant->participant_half_share < 1.0 - SPLITSHARE &&
+			participant->participant_half_x[0] * participant->participant_half_x[1] + participant->participant_half_y[0] * participant->participant_half_y[1] +
+			participant->participant_half_z[0] * participant->participant_half_z[1] < split_cos)
+		{
+			split_participant(meeting_data, participant_data_array, i);
+		}
+	}
+}
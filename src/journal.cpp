@@ -0,0 +1,596 @@
+//
+//  journal.cpp
+//
+//  the meeting journal.  The analytics thread packs records into the block at the head of a small
+//  spsc queue and moves head on when it is full or the meeting ends; the writer thread writes each
+//  block once, at a place fixed by how many data blocks came before it, so nothing already on the
+//  card is ever rewritten.  The file is grown JOURNALEXTENT blocks at a time with fallocate and
+//  synced every JOURNALSYNC blocks, which keeps what the card has to do for each byte of journal
+//  bounded: one block write, a share of an index block, and a metadata update every extent.
+//
+//  Data block d lives at block 1 + d + d / JOURNALINDEX, and the index block for data blocks
+//  g * JOURNALINDEX onwards straight after the last of them.  Blocks are written in order so the
+//  ones that have been are a prefix of the file, and the preallocated space after them reads as
+//  zeros, which is how a reader tells where the journal ends.  Everything is little endian
+//
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <time.h>
+
+#include "../include/journal.h"
+
+
+static unsigned long data_position(unsigned long data_block)
+{
+	return 1 + data_block + data_block / JOURNALINDEX;
+}
+
+// data blocks in a journal of this many blocks, header included
+static unsigned long data_blocks_in(unsigned long blocks)
+{
+	unsigned long after_header = blocks > 0 ? blocks - 1 : 0;
+	unsigned long partial = after_header % (JOURNALINDEX + 1);
+
+	return after_header / (JOURNALINDEX + 1) * JOURNALINDEX + (partial < JOURNALINDEX ? partial : JOURNALINDEX);
+}
+
+static long long monotonic_us()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+static bool read_header(int fd, unsigned long block, journal_block_header *header)
+{
+	return pread(fd, header, sizeof(*header), (off_t)block * JOURNALBLOCK) == sizeof(*header);
+}
+
+// blocks that have been written, header included.  They are a prefix of the file so this is a binary search
+static unsigned long written_blocks(int fd, unsigned long file_blocks)
+{
+	unsigned long low = 1, high = file_blocks, middle;
+	journal_block_header header;
+
+	while (low < high)
+	{
+		middle = (low + high) / 2;
+		if (read_header(fd, middle, &header) && header.magic == JOURNALMAGIC)
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+	return low;
+}
+
+static bool write_block(journal_writer *journal, unsigned long position, const void *block)
+{
+	if (position >= journal->allocated_blocks)
+	{
+		if (posix_fallocate(journal->fd, (off_t)journal->allocated_blocks * JOURNALBLOCK, (off_t)JOURNALEXTENT * JOURNALBLOCK) != 0)
+		{
+			return false;
+		}
+		journal->allocated_blocks += JOURNALEXTENT;
+	}
+	return pwrite(journal->fd, block, JOURNALBLOCK, (off_t)position * JOURNALBLOCK) == JOURNALBLOCK;
+}
+
+// writes the index block for the group of data blocks just finished
+static bool write_index(journal_writer *journal)
+{
+	unsigned char block[JOURNALBLOCK];
+	journal_block_header *header = (journal_block_header *)block;
+	uint32_t first = journal->data_blocks - JOURNALINDEX;
+
+	memset(block, 0, sizeof(block));
+	header->magic = JOURNALMAGIC;
+	header->kind = JOURNAL_INDEX;
+	header->records = JOURNALINDEX;
+	header->used = sizeof(*header) + sizeof(journal->index);
+	header->meeting = journal->index[0].meeting;
+	header->first_time = journal->index[0].first_time;
+	header->sequence = first;
+	memcpy(block + sizeof(*header), journal->index, sizeof(journal->index));
+
+	if (!write_block(journal, data_position(first + JOURNALINDEX - 1) + 1, block))
+	{
+		return false;
+	}
+	journal->file_blocks = data_position(first + JOURNALINDEX - 1) + 2;
+	return true;
+}
+
+// opens a journal to append to, creating it if there is none.  Meetings carry on being numbered from where the last
+// run left off, and if that run stopped between a group's last data block and its index, the index is written now
+bool journal_open_writer(journal_writer *journal, const char *filename)
+{
+	unsigned char block[JOURNALBLOCK];
+	journal_block_header *header = (journal_block_header *)block;
+	struct stat file_stat;
+	unsigned long d;
+	bool missing_index;
+
+	journal->head.store(0);
+	journal->tail.store(0);
+	journal->stopping.store(false);
+	journal->filling = false;
+	journal->meeting_open = false;
+	journal->records = 0;
+	journal->dropped.store(0);
+	journal->unsynced = 0;
+	journal->broken = false;
+	journal->blocks_written.store(0);
+	journal->failed.store(0);
+	journal->max_write_us.store(0);
+	journal->wake_fd = -1;
+
+	if ((journal->fd = open(filename, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) < 0 || fstat(journal->fd, &file_stat) < 0)
+	{
+		return false;
+	}
+	journal->allocated_blocks = file_stat.st_size / JOURNALBLOCK;
+
+	if (journal->allocated_blocks == 0)
+	{
+		memset(block, 0, sizeof(block));
+		header->magic = JOURNALMAGIC;
+		header->kind = JOURNAL_HEADER;
+		header->records = JOURNALVERSION;
+		header->used = JOURNALBLOCK;
+		if (!write_block(journal, 0, block))
+		{
+			return false;
+		}
+		journal->file_blocks = 1;
+	}
+	else if (!read_header(journal->fd, 0, header) || header->magic != JOURNALMAGIC || header->kind != JOURNAL_HEADER ||
+			 header->records != JOURNALVERSION || header->used != JOURNALBLOCK)
+	{
+		return false;
+	}
+	else
+	{
+		journal->file_blocks = written_blocks(journal->fd, journal->allocated_blocks);
+	}
+
+	// pick the current group's index up from its data blocks
+	journal->data_blocks = data_blocks_in(journal->file_blocks);
+	missing_index = journal->data_blocks > 0 && journal->data_blocks % JOURNALINDEX == 0 &&
+					journal->file_blocks == data_position(journal->data_blocks - 1) + 1;
+	d = missing_index ? journal->data_blocks - JOURNALINDEX : journal->data_blocks - journal->data_blocks % JOURNALINDEX;
+	for (; d < journal->data_blocks; d++)
+	{
+		if (!read_header(journal->fd, data_position(d), header))
+		{
+			return false;
+		}
+		journal->index[d % JOURNALINDEX].meeting = header->meeting;
+		journal->index[d % JOURNALINDEX].first_time = header->first_time;
+	}
+	journal->meeting = 1;
+	if (journal->data_blocks > 0)
+	{
+		if (!read_header(journal->fd, data_position(journal->data_blocks - 1), header))
+		{
+			return false;
+		}
+		journal->meeting = header->meeting + 1;
+	}
+	if (missing_index && !write_index(journal))
+	{
+		return false;
+	}
+
+	journal->wake_fd = eventfd(0, EFD_CLOEXEC);
+	return journal->wake_fd >= 0;
+}
+
+void journal_close_writer(journal_writer *journal)
+{
+	if (journal->fd >= 0)
+	{
+		fdatasync(journal->fd);
+		close(journal->fd);
+	}
+	if (journal->wake_fd >= 0)
+	{
+		close(journal->wake_fd);
+	}
+}
+
+// analytics side - hands the block at head to the writer
+static void submit_block(journal_writer *journal, bool sync)
+{
+	unsigned int head = journal->head.load(std::memory_order_relaxed);
+	uint64_t wake = 1;
+
+	journal->block[head & (JOURNALQUEUE - 1)].sync = sync;
+	journal->head.store(head + 1, std::memory_order_release);
+	journal->filling = false;
+	write(journal->wake_fd, &wake, sizeof(wake));
+}
+
+// analytics side - appends the meeting's state as it is after this frame.  If the writer is a whole queue behind the
+// record is dropped and counted rather than waited for
+void journal_record(journal_writer *journal, const meeting *meeting_data, const participant_data *participant_data_array)
+{
+	unsigned char record[JOURNALRECORDSIZE];
+	int length = JOURNALRECORDHEADER + build_payload_raw(record + JOURNALRECORDHEADER, meeting_data, participant_data_array);
+	uint16_t record_length = length;
+	uint32_t meeting_time = meeting_data->total_meeting_time;
+	uint32_t time_stamp = meeting_data->time_stamp;
+	unsigned int head = journal->head.load(std::memory_order_relaxed);
+	journal_block_header *header = (journal_block_header *)journal->block[head & (JOURNALQUEUE - 1)].data;
+
+	journal->meeting_open = true;
+	memcpy(record, &record_length, 2);
+	memcpy(record + 2, &meeting_time, 4);
+	memcpy(record + 6, &time_stamp, 4);
+
+	if (journal->filling && header->used + length > JOURNALBLOCK)
+	{
+		submit_block(journal, false);
+		head = journal->head.load(std::memory_order_relaxed);
+		header = (journal_block_header *)journal->block[head & (JOURNALQUEUE - 1)].data;
+	}
+
+	if (!journal->filling)
+	{
+		if (head - journal->tail.load(std::memory_order_acquire) >= JOURNALQUEUE)
+		{
+			journal->dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		header->magic = JOURNALMAGIC;
+		header->kind = JOURNAL_DATA;
+		header->records = 0;
+		header->used = sizeof(*header);
+		header->meeting = journal->meeting;
+		header->first_time = meeting_time;
+		header->sequence = 0;
+		journal->filling = true;
+	}
+
+	memcpy((unsigned char *)header + header->used, record, length);
+	header->used += length;
+	++header->records;
+	++journal->records;
+}
+
+// analytics side - the meeting is over, so its last block goes to the writer however full it is and the next record
+// starts the next meeting
+void journal_end_meeting(journal_writer *journal)
+{
+	unsigned int head = journal->head.load(std::memory_order_relaxed);
+	journal_block_header *header = (journal_block_header *)journal->block[head & (JOURNALQUEUE - 1)].data;
+
+	if (journal->filling)
+	{
+		memset((unsigned char *)header + header->used, 0, JOURNALBLOCK - header->used);
+		submit_block(journal, true);
+	}
+	if (journal->meeting_open)
+	{
+		++journal->meeting;
+		journal->meeting_open = false;
+	}
+}
+
+// writer side - writes every block that is queued.  The writer thread calls this each time it wakes, and anything
+// that records without a writer thread (the bench) can call it directly
+void journal_write_queued(journal_writer *journal)
+{
+	unsigned int tail;
+	journal_buffer *buffer;
+	journal_block_header *header;
+	unsigned long position;
+	long long start, elapsed;
+	bool ok;
+
+	while ((tail = journal->tail.load(std::memory_order_relaxed)) != journal->head.load(std::memory_order_acquire))
+	{
+		buffer = &journal->block[tail & (JOURNALQUEUE - 1)];
+		header = (journal_block_header *)buffer->data;
+		start = monotonic_us();
+
+		// a hole would hide every block after it from readers, so after a failure blocks are only counted
+		if (journal->broken)
+		{
+			journal->tail.store(tail + 1, std::memory_order_release);
+			journal->failed.fetch_add(1, std::memory_order_relaxed);
+			continue;
+		}
+
+		header->sequence = journal->data_blocks;
+		position = data_position(journal->data_blocks);
+		journal->index[journal->data_blocks % JOURNALINDEX].meeting = header->meeting;
+		journal->index[journal->data_blocks % JOURNALINDEX].first_time = header->first_time;
+
+		ok = write_block(journal, position, buffer->data);
+		if (ok)
+		{
+			journal->file_blocks = position + 1;
+			++journal->data_blocks;
+			++journal->unsynced;
+		}
+		if (ok && journal->data_blocks % JOURNALINDEX == 0)
+		{
+			ok = write_index(journal);
+		}
+		if (ok && (buffer->sync || journal->unsynced >= JOURNALSYNC))
+		{
+			ok = fdatasync(journal->fd) == 0;
+			journal->unsynced = 0;
+		}
+		journal->broken = !ok;
+		journal->tail.store(tail + 1, std::memory_order_release);
+
+		if (ok)
+		{
+			journal->blocks_written.fetch_add(1, std::memory_order_relaxed);
+		}
+		else
+		{
+			journal->failed.fetch_add(1, std::memory_order_relaxed);
+		}
+		elapsed = monotonic_us() - start;
+		if (elapsed > journal->max_write_us.load(std::memory_order_relaxed))
+		{
+			journal->max_write_us.store(elapsed, std::memory_order_relaxed);
+		}
+	}
+}
+
+// the writer thread.  Once stopped it still writes whatever was queued before returning
+void journal_writer_run(journal_writer *journal)
+{
+	uint64_t wakes;
+
+	for (;;)
+	{
+		journal_write_queued(journal);
+		if (journal->stopping.load(std::memory_order_acquire))
+		{
+			return;
+		}
+		read(journal->wake_fd, &wakes, sizeof(wakes));
+	}
+}
+
+// any thread - the writer finishes what is queued and returns
+void journal_stop(journal_writer *journal)
+{
+	uint64_t wake = 1;
+
+	journal->stopping.store(true, std::memory_order_release);
+	write(journal->wake_fd, &wake, sizeof(wake));
+}
+
+//
+// Readers
+//
+
+static const journal_block_header * block_at(const journal_reader *reader, unsigned long block)
+{
+	return (const journal_block_header *)(reader->base + block * JOURNALBLOCK);
+}
+
+// true if a record at (record_meeting, record_time) is not before (meeting, meeting_time)
+static bool not_before(uint32_t record_meeting, uint32_t record_time, uint32_t meeting, uint32_t meeting_time)
+{
+	return record_meeting > meeting || (record_meeting == meeting && record_time >= meeting_time);
+}
+
+// maps a journal for reading.  The reader sees the journal as it was when it was opened
+bool journal_open(journal_reader *reader, const char *filename)
+{
+	struct stat file_stat;
+	unsigned long low, high, middle, file_blocks;
+	void *base;
+
+	reader->base = NULL;
+	reader->blocks = 0;
+	if ((reader->fd = open(filename, O_RDONLY | O_CLOEXEC)) < 0)
+	{
+		return false;
+	}
+	if (fstat(reader->fd, &file_stat) < 0 || (file_blocks = file_stat.st_size / JOURNALBLOCK) == 0 ||
+		(base = mmap(NULL, file_blocks * JOURNALBLOCK, PROT_READ, MAP_SHARED, reader->fd, 0)) == MAP_FAILED)
+	{
+		close(reader->fd);
+		return false;
+	}
+	reader->base = (const unsigned char *)base;
+	reader->blocks = file_blocks;
+
+	if (block_at(reader, 0)->magic != JOURNALMAGIC || block_at(reader, 0)->kind != JOURNAL_HEADER ||
+		block_at(reader, 0)->records != JOURNALVERSION || block_at(reader, 0)->used != JOURNALBLOCK)
+	{
+		journal_close(reader);
+		return false;
+	}
+
+	// the preallocated space after the last block written is zeros
+	low = 1;
+	high = file_blocks;
+	while (low < high)
+	{
+		middle = (low + high) / 2;
+		if (block_at(reader, middle)->magic == JOURNALMAGIC)
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+	reader->blocks = low;
+	return true;
+}
+
+void journal_close(journal_reader *reader)
+{
+	if (reader->base != NULL)
+	{
+		munmap((void *)reader->base, reader->blocks * JOURNALBLOCK);
+	}
+	close(reader->fd);
+	reader->base = NULL;
+	reader->blocks = 0;
+}
+
+// the number of the last meeting in the journal, 0 if there are none
+uint32_t journal_meetings(const journal_reader *reader)
+{
+	unsigned long data_blocks = data_blocks_in(reader->blocks);
+
+	return data_blocks > 0 ? block_at(reader, data_position(data_blocks - 1))->meeting : 0;
+}
+
+// puts the cursor on the first record at or after meeting_time in the given meeting (or the first record of a later
+// meeting).  Index blocks narrow it down to a group, the group's own index to a block, and only that block's records
+// are looked at.  Returns false if there is nothing that late in the journal
+bool journal_seek(const journal_reader *reader, journal_cursor *cursor, uint32_t meeting, uint32_t meeting_time)
+{
+	unsigned long data_blocks = data_blocks_in(reader->blocks);
+	unsigned long groups = (reader->blocks - 1) / (JOURNALINDEX + 1);  // groups whose index block is there
+	unsigned long low, high, middle, found;
+	const journal_block_header *header;
+	const journal_index_entry *index;
+	journal_entry entry;
+
+	if (data_blocks == 0)
+	{
+		return false;
+	}
+
+	// the last group that starts before the target, by its index block
+	low = 0;
+	high = groups;
+	while (low < high)
+	{
+		middle = (low + high) / 2;
+		header = block_at(reader, data_position(middle * JOURNALINDEX + JOURNALINDEX - 1) + 1);
+		if (not_before(header->meeting, header->first_time, meeting, meeting_time))
+		{
+			high = middle;
+		}
+		else
+		{
+			low = middle + 1;
+		}
+	}
+
+	// then the last data block in it that starts before the target.  The blocks after the last index block have
+	// not been indexed yet, so if the target is past them their own headers are searched instead
+	if (low == 0 && groups > 0)
+	{
+		found = 0;
+	}
+	else if (low > 0 && (low < groups || groups * JOURNALINDEX == data_blocks ||
+						 not_before(block_at(reader, data_position(groups * JOURNALINDEX))->meeting,
+									  block_at(reader, data_position(groups * JOURNALINDEX))->first_time, meeting, meeting_time)))
+	{
+		found = (low - 1) * JOURNALINDEX;
+		index = (const journal_index_entry *)((const unsigned char *)block_at(reader, data_position(found + JOURNALINDEX - 1) + 1) +
+											  sizeof(journal_block_header));
+		low = 1;
+		high = JOURNALINDEX;
+		while (low < high)
+		{
+			middle = (low + high) / 2;
+			if (not_before(index[middle].meeting, index[middle].first_time, meeting, meeting_time))
+			{
+				high = middle;
+			}
+			else
+			{
+				low = middle + 1;
+			}
+		}
+		found += low - 1;
+	}
+	else
+	{
+		found = groups * JOURNALINDEX;
+		low = found + 1;
+		high = data_blocks;
+		while (low < high)
+		{
+			middle = (low + high) / 2;
+			header = block_at(reader, data_position(middle));
+			if (not_before(header->meeting, header->first_time, meeting, meeting_time))
+			{
+				high = middle;
+			}
+			else
+			{
+				low = middle + 1;
+			}
+		}
+		found = low - 1;
+	}
+
+	// walk on from there to the first record that is not before the target.  That is in this block or at the start
+	// of the next, however many records share a meeting_time
+	cursor->block = data_position(found);
+	cursor->offset = sizeof(journal_block_header);
+	for (;;)
+	{
+		journal_cursor here = *cursor;
+		if (!journal_next(reader, cursor, &entry))
+		{
+			return false;
+		}
+		if (not_before(entry.meeting, entry.meeting_time, meeting, meeting_time))
+		{
+			*cursor = here;
+			return true;
+		}
+	}
+}
+
+// the record at the cursor, moving the cursor on past it.  Returns false at the end of the journal
+bool journal_next(const journal_reader *reader, journal_cursor *cursor, journal_entry *entry)
+{
+	const journal_block_header *header;
+	const unsigned char *record;
+	uint16_t length;
+
+	for (; cursor->block < reader->blocks; cursor->block++, cursor->offset = sizeof(journal_block_header))
+	{
+		header = block_at(reader, cursor->block);
+		if (header->kind != JOURNAL_DATA || header->used > JOURNALBLOCK || cursor->offset + JOURNALRECORDHEADER > header->used)
+		{
+			continue;
+		}
+
+		// a torn or corrupt record ends the block rather than sending the cursor round in circles or off the end of it
+		record = (const unsigned char *)header + cursor->offset;
+		memcpy(&length, record, 2);
+		if (length < JOURNALRECORDHEADER || cursor->offset + length > header->used)
+		{
+			continue;
+		}
+		memcpy(&entry->meeting_time, record + 2, 4);
+		memcpy(&entry->time_stamp, record + 6, 4);
+		entry->meeting = header->meeting;
+		entry->state = record + JOURNALRECORDHEADER;
+		entry->length = length - JOURNALRECORDHEADER;
+		cursor->offset += length;
+		return true;
+	}
+	return false;
+}
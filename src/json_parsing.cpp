@@ -9,15 +9,15 @@
 #include "../include/json_parsing.h"
 
 
-void json_parse(char *buffer, odas_data * odas_array)
+int json_parse(char *buffer, odas_data * odas_array, int max_sources, unsigned long *time_stamp)
 {
   json_object *jobj;
   json_object *jobj_array;
   json_object *jobj_array_item;
 
-  unsigned int i, time_stamp;
+  unsigned int i;
   enum json_type type;
-  int arraylen;
+  int arraylen = 0;
 
 //    printf ("got in to json parse function\n");
 
@@ -25,6 +25,11 @@ void json_parse(char *buffer, odas_data * odas_array)
 
 //    printf ("got past jobj creation\n");
 
+  if (jobj == NULL)
+  {
+    return 0;
+  }
+
   json_object_object_foreach(jobj, key, val)
   {
 
@@ -33,13 +38,13 @@ void json_parse(char *buffer, odas_data * odas_array)
     {
     case json_type_int:
       if (!strcmp(key, "timeStamp"))
-        time_stamp = json_object_get_int(val) / 20;
-//	printf("timestamp: %d\n\n",time_stamp);
+        *time_stamp = json_object_get_int64(val);
+//	printf("timestamp: %lu\n\n",*time_stamp);
       break;
     case json_type_array:
       i = json_object_object_get_ex(jobj, key, &jobj_array);
       arraylen = json_object_array_length(jobj_array);
-      for (i = 0; i < arraylen; i++)
+      for (i = 0; i < arraylen && i < (unsigned int)max_sources; i++)
       {
         jobj_array_item = json_object_array_get_idx(jobj_array, i);
         json_parse_item(jobj_array_item, odas_array, i);
@@ -47,7 +52,9 @@ void json_parse(char *buffer, odas_data * odas_array)
       break;
     }
   }
-return;
+
+  json_object_put(jobj);
+return arraylen;
 }
 
 
@@ -72,6 +79,10 @@ void json_parse_item(json_object * jobj, odas_data * odas_array, const int index
           odas_array[index].y = json_object_get_double(val);
 //	printf("y (%d): %2.2f  ",index, odas_array[index].y);
       }
+      else if (!strcmp(key, "z"))
+      {
+          odas_array[index].z = json_object_get_double(val);
+      }
       else if (!strcmp(key, "activity"))
       {
           odas_array[index].activity = json_object_get_double(val);
@@ -91,3 +102,301 @@ void json_parse_item(json_object * jobj, odas_data * odas_array, const int index
 
 
 
+
+
+// Purpose-built parser for the odas SST frames.  It walks the buffer once and writes straight into
+// odas_array, so unlike the json-c path above it allocates nothing.  Only timeStamp and the x, y,
+// z, activity and freq members of src[] are picked up; any other key is skipped whatever its value is.
+// Malformed input stops the parse and leaves whatever had already been written.
+
+static const char * sst_skip_space(const char *p)
+{
+  while (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')
+  {
+    p++;
+  }
+  return p;
+}
+
+// p points at the opening quote.  Returns the character after the closing quote, or NULL
+static const char * sst_skip_string(const char *p)
+{
+  for (p++; *p != '"'; p++)
+  {
+    if (*p == 0x00)
+    {
+      return NULL;
+    }
+    if (*p == '\\' && *++p == 0x00)
+    {
+      return NULL;
+    }
+  }
+  return p + 1;
+}
+
+// compares the quoted key at p against name without copying it out
+static bool sst_key_is(const char *p, const char *end, const char *name)
+{
+  size_t len = strlen(name);
+  return (size_t)(end - p) == len + 2 && !memcmp(p + 1, name, len);
+}
+
+// Exact for everything odas prints (up to 15 significant digits and small exponents) because the
+// result is a single correctly rounded multiply or divide of two exactly representable values.
+// Anything outside that falls back to strtod, which does not allocate either
+static const char * sst_parse_number(const char *p, double *value)
+{
+  static const double power_of_ten[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+  const char *start = p;
+  bool negative = false, exp_negative = false;
+  unsigned long long mantissa = 0;
+  int digits = 0, scale = 0, exponent = 0;
+
+  if (*p == '-')
+  {
+    negative = true;
+    p++;
+  }
+  if (*p < '0' || *p > '9')
+  {
+    return NULL;
+  }
+  for (; *p >= '0' && *p <= '9'; p++, digits++)
+  {
+    mantissa = mantissa * 10 + (*p - '0');
+  }
+  if (*p == '.')
+  {
+    for (p++; *p >= '0' && *p <= '9'; p++, digits++, scale--)
+    {
+      mantissa = mantissa * 10 + (*p - '0');
+    }
+  }
+  if (*p == 'e' || *p == 'E')
+  {
+    p++;
+    if (*p == '-' || *p == '+')
+    {
+      exp_negative = (*p++ == '-');
+    }
+    for (; *p >= '0' && *p <= '9' && exponent < 1000; p++)
+    {
+      exponent = exponent * 10 + (*p - '0');
+    }
+    scale += exp_negative ? -exponent : exponent;
+  }
+
+  if (digits > 15 || scale < -22 || scale > 22)
+  {
+    *value = strtod(start, NULL);
+    return p;
+  }
+
+  *value = scale < 0 ? (double)mantissa / power_of_ten[-scale] : (double)mantissa * power_of_ten[scale];
+  if (negative)
+  {
+    *value = -*value;
+  }
+  return p;
+}
+
+// skips one value of any type - used for keys we do not care about
+static const char * sst_skip_value(const char *p)
+{
+  int depth = 0;
+  double ignored;
+
+  do
+  {
+    p = sst_skip_space(p);
+    switch (*p)
+    {
+    case '{':
+    case '[':
+      depth++;
+      p++;
+      break;
+    case '}':
+    case ']':
+      depth--;
+      p++;
+      break;
+    case ',':
+    case ':':
+      p++;
+      break;
+    case '"':
+      p = sst_skip_string(p);
+      break;
+    case 't':
+    case 'n':
+      p = strncmp(p, p[0] == 't' ? "true" : "null", 4) ? NULL : p + 4;
+      break;
+    case 'f':
+      p = strncmp(p, "false", 5) ? NULL : p + 5;
+      break;
+    default:
+      p = sst_parse_number(p, &ignored);
+      break;
+    }
+  } while (p != NULL && depth > 0);
+
+  return p;
+}
+
+// p points at the '{' of one src[] item
+static const char * sst_parse_item(const char *p, odas_data *item)
+{
+  const char *key, *key_end;
+  double value;
+
+  p = sst_skip_space(p + 1);
+  if (*p == '}')
+  {
+    return p + 1;
+  }
+
+  for (;;)
+  {
+    key = p;
+    if (*p != '"' || (key_end = sst_skip_string(p)) == NULL)
+    {
+      return NULL;
+    }
+    p = sst_skip_space(key_end);
+    if (*p++ != ':')
+    {
+      return NULL;
+    }
+    p = sst_skip_space(p);
+
+    if (*p == '-' || (*p >= '0' && *p <= '9'))
+    {
+      p = sst_parse_number(p, &value);
+      if (sst_key_is(key, key_end, "x"))
+      {
+        item->x = value;
+      }
+      else if (sst_key_is(key, key_end, "y"))
+      {
+        item->y = value;
+      }
+      else if (sst_key_is(key, key_end, "z"))
+      {
+        item->z = value;
+      }
+      else if (sst_key_is(key, key_end, "activity"))
+      {
+        item->activity = value;
+      }
+      else if (sst_key_is(key, key_end, "freq"))
+      {
+        item->frequency = (int)value;
+      }
+    }
+    else
+    {
+      p = sst_skip_value(p);
+    }
+
+    if (p == NULL)
+    {
+      return NULL;
+    }
+    p = sst_skip_space(p);
+    if (*p == '}')
+    {
+      return p + 1;
+    }
+    if (*p++ != ',')
+    {
+      return NULL;
+    }
+    p = sst_skip_space(p);
+  }
+}
+
+int sst_parse(char *buffer, odas_data * odas_array, int max_sources, unsigned long *time_stamp)
+{
+  const char *p = sst_skip_space(buffer);
+  const char *key, *key_end;
+  double value;
+  int index, num_sources = 0;
+
+  if (*p++ != '{')
+  {
+    return 0;
+  }
+
+  for (p = sst_skip_space(p); *p == '"'; p = sst_skip_space(p))
+  {
+    key = p;
+    if ((key_end = sst_skip_string(p)) == NULL)
+    {
+      return num_sources;
+    }
+    p = sst_skip_space(key_end);
+    if (*p++ != ':')
+    {
+      return num_sources;
+    }
+    p = sst_skip_space(p);
+
+    if (sst_key_is(key, key_end, "timeStamp") && (*p == '-' || (*p >= '0' && *p <= '9')))
+    {
+      p = sst_parse_number(p, &value);
+      if (p != NULL && value >= 0.0)
+      {
+        *time_stamp = value;
+      }
+    }
+    else if (sst_key_is(key, key_end, "src") && *p == '[')
+    {
+      // items beyond max_sources are parsed for syntax but not stored
+      p = sst_skip_space(p + 1);
+      for (index = 0; *p == '{'; index++)
+      {
+        num_sources = index + 1;
+        if (index < max_sources)
+        {
+          p = sst_parse_item(p, &odas_array[index]);
+        }
+        else
+        {
+          p = sst_skip_value(p);
+        }
+        if (p == NULL)
+        {
+          return num_sources;
+        }
+        p = sst_skip_space(p);
+        if (*p == ',')
+        {
+          p = sst_skip_space(p + 1);
+        }
+      }
+      if (*p++ != ']')
+      {
+        return num_sources;
+      }
+    }
+    else
+    {
+      p = sst_skip_value(p);
+    }
+
+    if (p == NULL)
+    {
+      return num_sources;
+    }
+    p = sst_skip_space(p);
+    if (*p != ',')
+    {
+      return num_sources;
+    }
+    p++;
+  }
+  return num_sources;
+}
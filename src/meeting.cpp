@@ -0,0 +1,386 @@
+//
+//  meeting.cpp
+//
+//  turns odas frames into meeting and participant statistics.  Nothing in here knows
+//  about bluetooth or sockets so it can be driven by meetpie, the bench or anything else
+//
+
+#include "../include/meetpie.h"
+#include "../include/clustering.h"
+#include "../include/bearing.h"
+
+
+// one odas channel's part of a frame.  (x, y, z) is its direction and elevation as a unit vector
+static inline void process_channel(meeting *meeting_data, participant_data *participant_data_array, odas_data *odas_data_array, int iChannel,
+								   double x, double y, double z, double direction, double elevation)
+{
+	int *frame_energy = meeting_data->frame_energy;
+	int number, energy;
+
+	//  dont use energy to check if track is active otherwise you miss the ending of the speech and
+	//  participant talking is never set to false
+	if (odas_data_array[iChannel].x != 0.0 && odas_data_array[iChannel].y != 0.0 && odas_data_array[iChannel].activity >= meeting_data->tuning.min_energy)
+	{
+		meeting_data->total_silence = 0;  // consider moving this
+
+		// check to see if the source is coming from a known participant.  If not it may be someone new
+		number = cluster_assign(meeting_data, participant_data_array, direction, elevation);
+		if (number == NOPARTICIPANT)
+		{
+			number = cluster_prospect(meeting_data, participant_data_array, iChannel, direction, elevation, x, y, z);
+			if (number != NOPARTICIPANT)
+			{
+				++meeting_data->num_talking; // another person is talking in this session
+				participant_data_array[number].participant_is_talking = 1;
+				frame_energy[number] = odas_data_array[iChannel].activity * 1000;
+			}
+		}
+		else // its an existing talker we're hearing
+		{
+			meeting_data->prospective_source[iChannel] = 0;
+			meeting_data->prospective_x[iChannel] = 0.0;
+			meeting_data->prospective_y[iChannel] = 0.0;
+			meeting_data->prospective_z[iChannel] = 0.0;
+
+			cluster_update(meeting_data, participant_data_array, number, direction, elevation, x, y, z);
+			participant_data_array[number].participant_is_talking = 1;
+			participant_data_array[number].participant_total_talk_time += meeting_data->frame_span;
+			++meeting_data->num_talking; // another person is talking in this session
+
+			energy = odas_data_array[iChannel].activity * 1000;
+			if (energy > frame_energy[number])
+			{
+				frame_energy[number] = energy;
+			}
+
+//			if (odas_data_array[iChannel].frequency > 0.0)
+//			{
+//				participant_data_array[number].participant_frequency = (0.9 * participant_data_array[number].participant_frequency) + (0.1 * odas_data_array[iChannel].frequency);
+//			}
+		}
+	}
+	else
+	{
+		meeting_data->prospective_source[iChannel] = 0;
+		meeting_data->prospective_x[iChannel] = 0.0;
+		meeting_data->prospective_y[iChannel] = 0.0;
+		meeting_data->prospective_z[iChannel] = 0.0;
+		meeting_data->total_silence += meeting_data->frame_elapsed;
+	}
+}
+
+// the channels of a frame.  SOURCES is the channel count for the common odas configurations, so the loop has a
+// fixed trip count the compiler can unroll; 0 takes the count from the meeting for anything else
+template <int SOURCES>
+static void process_channels(meeting *meeting_data, participant_data *participant_data_array, odas_data *odas_data_array)
+{
+	const int num_channels = SOURCES > 0 ? SOURCES : meeting_data->num_channels;
+	int iChannel;
+	double x[MAXCHANNELS], y[MAXCHANNELS], z[MAXCHANNELS], direction[MAXCHANNELS], elevation[MAXCHANNELS];
+
+	// only the direction matters, not how far away odas thinks they are.  Every channel's is worked out in one pass
+	source_directions(odas_data_array, num_channels, x, y, z, direction, elevation);
+
+	for (iChannel = 0; iChannel < num_channels ; iChannel++)
+	{
+		process_channel(meeting_data, participant_data_array, odas_data_array, iChannel, x[iChannel], y[iChannel], z[iChannel],
+						direction[iChannel], elevation[iChannel]);
+	}
+}
+
+// works out how much meeting time a frame with this odas timeStamp covers.  Frames missing before it are counted as
+// lost, and it stands for up to MAXFRAMEGAP of them - whoever is talking now was most likely talking through a short
+// gap, but nobody is credited with a long one.  The first frame of a meeting, and one whose timeStamp has not moved
+// on (odas restarting, or not sending one), covers a single frame
+static void advance_clock(meeting *meeting_data, unsigned long time_stamp)
+{
+	unsigned long elapsed = 1;
+
+	if (meeting_data->total_meeting_time > 0 && time_stamp > meeting_data->time_stamp && time_stamp - meeting_data->time_stamp < INT_MAX / 2)
+	{
+		elapsed = time_stamp - meeting_data->time_stamp;
+	}
+	if (elapsed > 1)
+	{
+		meeting_data->lost_frames += elapsed - 1;
+		++meeting_data->frame_gaps;
+	}
+
+	meeting_data->time_stamp = time_stamp;
+	meeting_data->frame_elapsed = elapsed;
+	meeting_data->frame_span = elapsed < MAXFRAMEGAP ? elapsed : MAXFRAMEGAP;
+	meeting_data->total_meeting_time += elapsed;
+}
+
+// slides everyone's energy window on by the frames this one covers - the oldest samples leave the running sum as the
+// new ones join, so a frame costs the same whatever the window length.  Frames it stands for get its energy, and any
+// gap beyond those gets none
+static void advance_energy_window(meeting *meeting_data)
+{
+	int steps = meeting_data->frame_elapsed < TALKERWINDOW ? meeting_data->frame_elapsed : TALKERWINDOW;
+	int quiet = steps - (meeting_data->frame_span < steps ? meeting_data->frame_span : steps);
+	int i, step, position, energy;
+
+	for (i = 0; i < meeting_data->num_participants; i++)
+	{
+		position = meeting_data->window_position;
+		for (step = 0; step < steps; step++)
+		{
+			energy = step < quiet ? 0 : meeting_data->frame_energy[i];
+			meeting_data->energy_sum[i] += energy - meeting_data->energy_window[i][position];
+			meeting_data->energy_window[i][position] = energy;
+			if (++position == TALKERWINDOW)
+			{
+				position = 0;
+			}
+		}
+	}
+	meeting_data->window_position = (meeting_data->window_position + steps) % TALKERWINDOW;
+}
+
+void process_sound_data(meeting *meeting_data, participant_data *participant_data_array, odas_data *odas_data_array, unsigned long time_stamp)
+
+{
+	int i;
+	int *frame_energy = meeting_data->frame_energy;
+
+	meeting_data->num_talking=0;
+	advance_clock(meeting_data, time_stamp);
+
+	// talking state only describes the current frame, so clear it before we look at the new one
+	for (i = 0; i < meeting_data->num_participants; i++)
+	{
+		participant_data_array[i].participant_is_talking = 0;
+		frame_energy[i] = 0;
+	}
+
+	// everyone we are tracking has moved on a frame since we last heard them
+	cluster_predict(meeting_data, participant_data_array);
+
+	switch (meeting_data->num_channels)
+	{
+	case 3:
+		process_channels<3>(meeting_data, participant_data_array, odas_data_array);
+		break;
+	case 4:
+		process_channels<4>(meeting_data, participant_data_array, odas_data_array);
+		break;
+	case 6:
+		process_channels<6>(meeting_data, participant_data_array, odas_data_array);
+		break;
+	default:
+		process_channels<0>(meeting_data, participant_data_array, odas_data_array);
+		break;
+	}
+
+	// people who have moved may now be sitting on top of someone else, or turn out to be two people
+	cluster_maintain(meeting_data, participant_data_array);
+
+// new logic by sd to calc turns using energy
+
+	for (i = 0; i < meeting_data->num_participants; i++)
+	{
+		if (participant_data_array[i].participant_is_talking == 1 && meeting_data->num_talking == 1)
+		{
+			if (meeting_data->last_talker!=i) // its a change of turn
+			{
+				++participant_data_array[i].participant_num_turns;
+				meeting_data->last_talker = i;
+			}
+		}
+	}
+// end of new turn logic
+
+	advance_energy_window(meeting_data);
+	meeting_data->dominant_talker = NOPARTICIPANT;
+	for (i = 0; i < meeting_data->num_participants; i++)
+	{
+		participant_data_array[i].participant_energy = meeting_data->energy_sum[i] / (TALKERWINDOW * 10);
+
+		if (meeting_data->energy_sum[i] > 0 &&
+			(meeting_data->dominant_talker == NOPARTICIPANT || meeting_data->energy_sum[i] > meeting_data->energy_sum[meeting_data->dominant_talker]))
+		{
+			meeting_data->dominant_talker = i;
+		}
+	}
+
+	detect_interruptions(meeting_data, participant_data_array, frame_energy);
+}
+
+// An interruption is someone other than the dominant talker coming in above INTERRUPTENERGY while the dominant
+// talker is still speaking.  It is successful if they go on to become the dominant talker themselves, and is over
+// without success once they have been quiet for MINTURNSILENCE frames of meeting time.  Each participant carries their own state, so
+// every frame costs the same however long the meeting has gone on.  frame_energy is this frame's activity per
+// participant in thousandths
+void detect_interruptions(meeting *meeting_data, participant_data *participant_data_array, const int *frame_energy)
+{
+	int i;
+	int holder = meeting_data->dominant_talker;
+	participant_data *participant;
+
+	for (i = 0; i < meeting_data->num_participants; i++)
+	{
+		participant = &participant_data_array[i];
+
+		if (participant->participant_interrupting)
+		{
+			if (holder == i)
+			{
+				++participant->participant_interrupts_successful;
+				participant->participant_interrupting = 0;
+			}
+			else if (frame_energy[i] > 0)
+			{
+				participant->participant_interrupt_quiet = 0;
+			}
+			else if ((participant->participant_interrupt_quiet += meeting_data->frame_elapsed) > MINTURNSILENCE)
+			{
+				participant->participant_interrupting = 0;
+			}
+		}
+		else if (holder != NOPARTICIPANT && holder != i && frame_energy[holder] > 0 && frame_energy[i] > INTERRUPTENERGY * 1000)
+		{
+			++participant->participant_interrupts_attempted;
+			participant->participant_interrupting = 1;
+			participant->participant_interrupt_quiet = 0;
+		}
+	}
+}
+
+// empties a participant slot so it can be reused
+void initialise_participant(participant_data *participant)
+{
+	participant->participant_angle = 0;
+	participant->participant_is_talking = 0;
+	participant->participant_silent_time = 0;
+	participant->participant_total_talk_time = 0;
+	participant->participant_num_turns = 0;
+	participant->participant_frequency = 150.0;
+	participant->participant_energy = 0;
+	participant->participant_interrupts_attempted = 0;
+	participant->participant_interrupts_successful = 0;
+	participant->participant_interrupting = 0;
+	participant->participant_interrupt_quiet = 0;
+	participant->participant_direction = 0.0;
+	participant->participant_turn = 0.0;
+	participant->participant_variance[0] = participant->participant_variance[1] = participant->participant_variance[2] = 0.0;
+	participant->participant_elevation = 0.0;
+	participant->participant_elevation_variance = 0.0;
+	participant->participant_x = 0.0;
+	participant->participant_y = 0.0;
+	participant->participant_z = 0.0;
+	participant->participant_half_x[0] = participant->participant_half_x[1] = 0.0;
+	participant->participant_half_y[0] = participant->participant_half_y[1] = 0.0;
+	participant->participant_half_z[0] = participant->participant_half_z[1] = 0.0;
+	participant->participant_half_share = 0.0;
+	participant->participant_frames = 0;
+	participant->participant_bearing = 0;
+	participant->participant_position = 0;
+}
+
+// allocates the participant pool, and the per participant state the meeting keeps alongside it, for up to
+// max_participants people.  Nothing is allocated after this however the meeting goes
+bool allocate_meeting_data(meeting *meeting_data, participant_data **participant_data_array, int max_participants)
+{
+	int i;
+
+	default_tuning(&meeting_data->tuning);
+	meeting_data->max_participants = max_participants;
+	meeting_data->num_participants = 0;
+	meeting_data->num_channels = NUMCHANNELS;
+	meeting_data->energy_window = (short (*)[TALKERWINDOW])calloc(max_participants, sizeof(*meeting_data->energy_window));
+	meeting_data->energy_sum = (int *)calloc(max_participants, sizeof(int));
+	meeting_data->frame_energy = (int *)calloc(max_participants, sizeof(int));
+	meeting_data->bearing_index = (int *)calloc(max_participants, sizeof(int));
+	meeting_data->bearing_count = 0;
+	*participant_data_array = (participant_data *)malloc(max_participants * sizeof(participant_data));
+
+	if (meeting_data->energy_window == NULL || meeting_data->energy_sum == NULL || meeting_data->frame_energy == NULL || meeting_data->bearing_index == NULL ||
+		*participant_data_array == NULL)
+	{
+		free_meeting_data(meeting_data, *participant_data_array);
+		*participant_data_array = NULL;
+		return false;
+	}
+
+	for (i = 0; i < max_participants; i++)
+	{
+		initialise_participant(&(*participant_data_array)[i]);
+	}
+	return true;
+}
+
+// the thresholds meetpie was built with.  Activity has never gated who is heard, as gating on it cuts off the ends of
+// people's speech, so min_energy starts at 0 rather than at MINENERGY
+void default_tuning(meeting_tuning *tuning)
+{
+	tuning->min_energy = 0.0;
+	tuning->angle_spread = ANGLESPREAD;
+	tuning->min_talk_time = MINTALKTIME;
+	tuning->max_silence = MAXSILENCE;
+}
+
+// true once someone has been heard and nobody has for longer than the meeting's max_silence
+bool meeting_is_over(const meeting *meeting_data)
+{
+	return meeting_data->total_silence > meeting_data->tuning.max_silence && meeting_data->num_participants > 0;
+}
+
+void free_meeting_data(meeting *meeting_data, participant_data *participant_data_array)
+{
+	free(meeting_data->energy_window);
+	free(meeting_data->energy_sum);
+	free(meeting_data->frame_energy);
+	free(meeting_data->bearing_index);
+	free(participant_data_array);
+	meeting_data->energy_window = NULL;
+	meeting_data->energy_sum = NULL;
+	meeting_data->frame_energy = NULL;
+	meeting_data->bearing_index = NULL;
+}
+
+// starts a new meeting.  Only the slots the last meeting used need clearing, so this costs the same however big the pool is
+void initialise_meeting_data(meeting *meeting_data, participant_data *participant_data_array, odas_data *odas_data_array)
+{
+
+	int i;
+
+	// initialise meeting array
+	for (i = 0; i < meeting_data->num_participants; i++)
+	{
+		initialise_participant(&participant_data_array[i]);
+		meeting_data->energy_sum[i] = 0;
+		meeting_data->frame_energy[i] = 0;
+	}
+	memset(meeting_data->energy_window, 0, meeting_data->num_participants * sizeof(*meeting_data->energy_window));
+
+	for (i = 0; i < MAXCHANNELS; i++)
+	{
+		odas_data_array[i].x = 0.0;
+		odas_data_array[i].y = 0.0;
+		odas_data_array[i].z = 0.0;
+		odas_data_array[i].activity = 0.0;
+		odas_data_array[i].frequency = 0.0;
+
+		meeting_data->prospective_source[i] = 0;
+		meeting_data->prospective_x[i] = 0.0;
+		meeting_data->prospective_y[i] = 0.0;
+		meeting_data->prospective_z[i] = 0.0;
+	}
+
+	meeting_data->total_silence = 0;
+	meeting_data->total_meeting_time = 0;
+	meeting_data->time_stamp = 0;
+	meeting_data->frame_elapsed = 1;
+	meeting_data->frame_span = 1;
+	meeting_data->lost_frames = 0;
+	meeting_data->frame_gaps = 0;
+	meeting_data->num_participants = 0;
+	meeting_data->participants_registered = 0;
+	meeting_data->bearing_count = 0;
+	meeting_data->last_talker = NOPARTICIPANT;
+	meeting_data->num_talking = 0;
+
+	meeting_data->window_position = 0;
+	meeting_data->dominant_talker = NOPARTICIPANT;
+}
@@ -47,29 +47,57 @@
 //
 
 #include <signal.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
 #include <iostream>
 #include <thread>
 #include <sstream>
 #include <mutex>
-#include <fstream>
+#include <atomic>
 
 #include "../include/ggk.h"
 // meetpie specific
 #include "../include/meetpie.h"
 #include "../include/json_parsing.h"
+#include "../include/odas_ring.h"
+#include "../include/payload.h"
+#include "../include/snapshot.h"
+#include "../include/archive.h"
+#include "../include/journal.h"
+#include "../include/recording.h"
+#include "../include/tuning.h"
 
 
 // Maximum time to wait for any single async process to timeout during initialization
 static const int kMaxAsyncInitTimeoutMS = 30 * 1000;
 
-//mutex so that we can multi-thread
-std::mutex mutex_buffer;
-
 // The battery level ("battery/level") reported by the server (see Server.cpp)
 static uint8_t serverDataBatteryLevel = 100;
 
 // The text string ("text/string") used by our custom text string service (see Server.cpp)
-static std::string serverDataTextString;
+//
+// The analytics thread builds each version straight into the back buffer of this snapshot and the server thread
+// reads the front one, so neither thread has to lock the other out
+static payload_snapshot serverDataTextSnapshot;
+
+// Which payload format the text string is served in (see payload.cpp).  Json text unless -u starts us in delta mode
+// or a client writes "json", "delta" or "binary" to the text string.  Written by the server thread, read by the
+// analytics thread
+static std::atomic<int> serverDataFormat(PAYLOAD_TEXT);
+static payload_delta_state serverDataDelta;
+
+// Finished meetings on their way to the archive writer thread (see archive.cpp)
+static archive_queue meetingArchive;
+
+// Every frame of every meeting, when -J names a journal to keep it in (see journal.cpp)
+static journal_writer meetingJournal;
+static bool journalling = false;
+
+// Every datagram odas sends, when --record names a file to capture them in (see recording.cpp)
+static recording_writer odasRecording;
 
 //
 // Logging
@@ -145,8 +173,8 @@ void signalHandler(int signum)
 //
 // This method conforms to `GGKServerDataGetter` and is passed to the server via our call to `ggkStart()`.
 //
-// The server calls this method from its own thread, so we must ensure our implementation is thread-safe. In our case, we're simply
-// sending over stored values, so we don't need to take any additional steps to ensure thread-safety.
+// The server calls this method from its own thread, so we must ensure our implementation is thread-safe. The text string comes
+// from the triple buffered snapshot, which always hands back a complete payload that will not change under the server.
 const void *dataGetter(const char *pName)
 {
 
@@ -164,15 +192,7 @@ const void *dataGetter(const char *pName)
 	}
 	else if (strName == "text/string")
 	{
-//		std::string serverOutputString;
-
-//		mutex_buffer.lock();
-
-//		serverOutputString = serverDataTextString;
-
-//		mutex_buffer.unlock();
-
-		return serverDataTextString.c_str();
+		return snapshot_read(&serverDataTextSnapshot)->text;
 	}
 
 	LogWarn((std::string("Unknown name for server data getter request: '") + pName + "'").c_str());
@@ -209,9 +229,27 @@ int dataSetter(const char *pName, const void *pData)
 	}
 	else if (strName == "text/string")
 	{
-		//		need to change this below as will no lnger work
-		//		serverDataTextString = static_cast<const char *>(pData);
-		LogDebug((std::string("Server data: text string set to '") + serverDataTextString + "'").c_str());
+		// a write to the text string is how a client picks the payload format it wants
+		std::string format = static_cast<const char *>(pData);
+
+		if (format == "json")
+		{
+			serverDataFormat = PAYLOAD_TEXT;
+		}
+		else if (format == "delta")
+		{
+			serverDataFormat = PAYLOAD_DELTA;
+		}
+		else if (format == "binary")
+		{
+			serverDataFormat = PAYLOAD_BINARY;
+		}
+		else
+		{
+			LogWarn((std::string("Unknown text string format requested: '") + format + "'").c_str());
+			return 0;
+		}
+		LogDebug((std::string("Server data: text string format set to '") + format + "'").c_str());
 		return 1;
 	}
 
@@ -220,148 +258,366 @@ int dataSetter(const char *pName, const void *pData)
 	return 0;
 }
 
-//  the following three functions are called whn we have UDP data
-// I will build them into seprate files eventually
+// builds the string for the data getter from the current meeting state and tells the server it has changed
+static void publish_meeting_data(meeting *meeting_data, participant_data *participant_data_array)
+{
+	static int last_format = PAYLOAD_TEXT;
+	payload_buffer *payload;
+	int format = serverDataFormat.load();
+
+	// a client that has just switched to deltas needs a keyframe to start from
+	if (format != last_format)
+	{
+		payload_delta_reset(&serverDataDelta);
+		last_format = format;
+	}
+
+	// build the payload in place and hand it over to the data getter
+	payload = snapshot_write_buffer(&serverDataTextSnapshot);
+	switch (format)
+	{
+	case PAYLOAD_DELTA:
+		payload->length = build_payload_delta(payload->text, MAXPAYLOAD, &serverDataDelta, meeting_data, participant_data_array);
+		break;
+	case PAYLOAD_BINARY:
+		payload->length = build_payload_binary(payload->text, MAXPAYLOAD, meeting_data, participant_data_array);
+		break;
+	default:
+		payload->length = build_payload_text(payload->text, MAXPAYLOAD, meeting_data, participant_data_array);
+		break;
+	}
+
+	// a delta with nobody in it is not worth a notification
+	if (payload->length > 0)
+	{
+		if (format != PAYLOAD_BINARY)
+		{
+			printf ("%s\n",payload->text);
+		}
+		snapshot_publish(&serverDataTextSnapshot);
 
-void process_sound_data(meeting *meeting_data, participant_data *participant_data_array, odas_data *odas_data_array)
+		// now the output string is ready and we should call notify
+		ggkNofifyUpdatedCharacteristic("/com/gobbledegook/text/string");
+	}
+}
 
+// once a meeting has been silent for long enough it is written to file and everything is reset for the next one
+static void end_meeting(meeting *meeting_data, participant_data *participant_data_array, odas_data *odas_data_array)
 {
-	int target_angle;
-	int iChannel, iAngle;
-	static int prospective_source[4] = {0,0,0,0};  // not pretty but will work for now - assumes NUMCHANNELS <= 4
+	archive_entry *entry;
 
-	meeting_data->num_talking=0;
-	meeting_data->total_meeting_time++;
+	if (meeting_data->lost_frames > 0)
+	{
+		LogWarn((std::string("meeting of ") + std::to_string(meeting_data->total_meeting_time) + " frames lost " + std::to_string(meeting_data->lost_frames) +
+				 " of them in " + std::to_string(meeting_data->frame_gaps) + " gaps").c_str());
+	}
 
-	for (iChannel = 0; iChannel < NUMCHANNELS ; iChannel++)
+	// the archive always gets the full text, whatever we serve.  It is built straight into the writer's queue and
+	// written out on the writer's thread, so a slow SD card never holds up the next frame
+	if ((entry = archive_entry_to_fill(&meetingArchive)) != NULL)
 	{
-		//  dont use energy to check if track is active otherwise you miss the ending of the speech and
-		//  participant talking is never set to false
-		if (odas_data_array[iChannel].x != 0.0 && odas_data_array[iChannel].y != 0.0)
-		{
-			meeting_data->total_silence = 0;  // consider moving this
-			target_angle = 180 - (atan2(odas_data_array[iChannel].x, odas_data_array[iChannel].y) * 57.3);
+		entry->length = build_payload_text(entry->text, MAXPAYLOAD, meeting_data, participant_data_array);
+		archive_submit(&meetingArchive);
+	}
+	else
+	{
+		LogError("Archive writer has fallen behind, meeting not archived");
+	}
+	if (journalling)
+	{
+		journal_end_meeting(&meetingJournal);
+	}
 
-			// participant_number holds a int for every angle position.  Once an angle is set to true a person is registered there
-			// so if tracked source is picked up we check to see if it is coming from a known participant
-			// if it is not yet known then we also check that we havent reached max particpants before trying to add a new one
+	// reset data for next meeting
+	initialise_meeting_data(meeting_data, participant_data_array, odas_data_array);
+	payload_delta_reset(&serverDataDelta);
+}
 
-			//max_num_participants -1 so that we dont go out of bounds - means 0 is never used so will need to optimise
+// true when the server already has enough notifications queued that another one would only add to the backlog
+static bool update_queue_is_deep()
+{
+	return ggkUpdateQueueSize() >= MAXUPDATEQUEUE;
+}
 
-			if (meeting_data->participant_number[target_angle] == 0x00 && meeting_data->num_participants < (MAXPART - 1))
-			{
+//
+// Ingest thread
+//
 
-				if (++prospective_source[iChannel] > MINTALKTIME ) // once they have talked for X secs we are more certain they are a member
-				{
+// everything the ingest thread needs.  The counters are only written by the ingest thread and are read once it has been joined
+typedef struct ingest_state{
+	int sockfd;
+	int frames_fd;
+	int stop_fd;
+	bool batch_ingest;
+	odas_parser parse;
+	odas_ring *ring;
+	recording_writer *recording;		// NULL unless --record
+	unsigned long batch_wakeups;
+	unsigned long batch_frames;
+	int batch_max_frames;
+ } ingest_state;
+
+// Receives odas datagrams, parses them and pushes the frames into the ring for the analytics thread.  Nothing in here
+// waits on the BLE server or the file system, so a slow notify or write can no longer make the kernel drop datagrams
+static void ingest_odas_data(ingest_state *ingest)
+{
+	int epoll_fd, num_events, e;
+	int bytes_returned, num_messages, m, frames_in_batch, num_sources;
+	bool stopping = false;
+	struct epoll_event event;
+	struct epoll_event events[MAXEVENTS];
+	struct sockaddr_in in_addr;
+	socklen_t len;
+	char input_buffer[MAXLINE];
+	odas_frame frame;
+	uint64_t frames_signal = 1;
+	unsigned long time_stamp = 0;
 
-					meeting_data->num_participants++;
-					++meeting_data->num_talking; // another person is talking in this session
-					meeting_data->participant_number[target_angle] = meeting_data->num_participants;
-					participant_data_array[meeting_data->num_participants].participant_angle = target_angle;
+	// odas only sends the fields it has, so the parse target persists between datagrams and is copied into each frame
+	odas_data *odas_data_array = (odas_data *)malloc(MAXCHANNELS * sizeof(odas_data));
+	memset(odas_data_array, 0, MAXCHANNELS * sizeof(odas_data));
 
-					participant_data_array[meeting_data->num_participants].participant_frequency = 200.0;
-					// write a buffer around them
+	// preallocated buffers for batched ingest - one MAXLINE buffer per datagram recvmmsg can hand back
+	static char batch_buffer[MAXBATCH][MAXLINE];
+	struct mmsghdr batch_headers[MAXBATCH];
+	struct iovec batch_iovecs[MAXBATCH];
 
-					for (iAngle = 1; iAngle < ANGLESPREAD; iAngle++)
-					{
-						if (target_angle + iAngle < 360)
-						{
-						// could check if already set here - but for now will just overwrite
-						// 360 is for going round the clock face
+	memset(batch_headers, 0, sizeof(batch_headers));
+	for (m = 0; m < MAXBATCH; m++)
+	{
+		batch_iovecs[m].iov_base = batch_buffer[m];
+		batch_iovecs[m].iov_len = MAXLINE - 1;
+		batch_headers[m].msg_hdr.msg_iov = &batch_iovecs[m];
+		batch_headers[m].msg_hdr.msg_iovlen = 1;
+	}
 
-							meeting_data->participant_number[target_angle + iAngle] = meeting_data->num_participants;
-						}
-						else
-						{
-							meeting_data->participant_number[iAngle - 1] = meeting_data->num_participants;
-						}
-						if (target_angle - iAngle >= 0)
-						{
-							// could check if already set here - but for now will just overwrite
-							// 360 is for going round the clock face
-							meeting_data->participant_number[target_angle - iAngle] = meeting_data->num_participants;
-						}
-						else
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	event.events = EPOLLIN;
+	event.data.fd = ingest->sockfd;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ingest->sockfd, &event);
+	event.data.fd = ingest->stop_fd;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ingest->stop_fd, &event);
+
+	while (!stopping)
+	{
+		// with --record, wake at least every half RECORDINGFLUSHUS so a quiet spell cannot strand the last datagrams
+		num_events = epoll_wait(epoll_fd, events, MAXEVENTS, ingest->recording != NULL ? RECORDINGFLUSHUS / 2000 : -1);
+
+		for (e = 0; e < num_events; e++)
+		{
+			if (events[e].data.fd == ingest->stop_fd)
+			{
+				stopping = true;
+			}
+			else if (ingest->batch_ingest)
+			{
+				// pull everything that is queued in as few syscalls as possible
+				frames_in_batch = 0;
+
+				do
+				{
+					num_messages = recvmmsg(ingest->sockfd, batch_headers, MAXBATCH, MSG_DONTWAIT, NULL);
+
+					for (m = 0; m < num_messages; m++)
+					{
+						batch_buffer[m][batch_headers[m].msg_len] = 0x00; // sets end for json parser
+						if (ingest->recording != NULL)
 						{
-							meeting_data->participant_number[361 - iAngle] = meeting_data->num_participants;
+							recording_add(ingest->recording, batch_buffer[m], batch_headers[m].msg_len);
 						}
-					}	
+						num_sources = ingest->parse(batch_buffer[m], odas_data_array, MAXCHANNELS, &time_stamp);
+						memcpy(frame.source, odas_data_array, sizeof(frame.source));
+						frame.num_sources = num_sources < MAXCHANNELS ? num_sources : MAXCHANNELS;
+						frame.time_stamp = time_stamp;
+						odas_ring_push(ingest->ring, &frame);
+					}
 
-					participant_data_array[meeting_data->num_participants].participant_is_talking = iChannel;
-				}	
+					if (num_messages > 0)
+					{
+						frames_in_batch += num_messages;
+					}
+				} while (num_messages == MAXBATCH);
+
+				if (frames_in_batch > 0)
+				{
+					++ingest->batch_wakeups;
+					ingest->batch_frames += frames_in_batch;
+					if (frames_in_batch > ingest->batch_max_frames)
+					{
+						ingest->batch_max_frames = frames_in_batch;
+					}
+					if (logLevel <= Debug)
+					{
+						LogDebug((std::string("coalesced ") + std::to_string(frames_in_batch) + " frames").c_str());
+					}
+
+					write(ingest->frames_fd, &frames_signal, sizeof(frames_signal));
+				}
 			}
-			else // its an existing talker we're hearing
+			else
 			{
-				// could put logic in here to count turns
-				participant_data_array[meeting_data->participant_number[target_angle]].participant_is_talking = 1;
-				participant_data_array[meeting_data->participant_number[target_angle]].participant_total_talk_time++;
-				++meeting_data->num_talking; // another person is talking in this session
-
-//				if (odas_data_array[iChannel].frequency > 0.0)
-//				{
-//					participant_data_array[meeting_data->participant_number[target_angle]].participant_frequency = (0.9 * participant_data_array[meeting_data->participant_number[target_angle]].participant_frequency) + (0.1 * odas_data_array[iChannel].frequency);
-//				}
+				len = sizeof(in_addr); //length data is neeeded for receive call
+				frames_in_batch = 0;
+
+				while ((bytes_returned = recvfrom(ingest->sockfd, (char *)input_buffer, MAXLINE - 1,
+												  MSG_DONTWAIT, (struct sockaddr *)&in_addr,
+												  &len)) > 0)
+				{
+					input_buffer[bytes_returned] = 0x00; // sets end for json parser
+					if (ingest->recording != NULL)
+					{
+						recording_add(ingest->recording, input_buffer, bytes_returned);
+					}
+					if (logLevel <= Debug)
+					{
+						LogDebug(input_buffer);
+					}
+					num_sources = ingest->parse(input_buffer, odas_data_array, MAXCHANNELS, &time_stamp);
+					memcpy(frame.source, odas_data_array, sizeof(frame.source));
+					frame.num_sources = num_sources < MAXCHANNELS ? num_sources : MAXCHANNELS;
+					frame.time_stamp = time_stamp;
+					odas_ring_push(ingest->ring, &frame);
+					++frames_in_batch;
+				}
+
+				if (frames_in_batch > 0)
+				{
+					write(ingest->frames_fd, &frames_signal, sizeof(frames_signal));
+				}
 			}
 		}
-		else
+
+		if (ingest->recording != NULL)
 		{
-			prospective_source[iChannel] = 0;
-			meeting_data->total_silence++;
+			recording_flush_due(ingest->recording);
 		}
 	}
-}
 
-void initialise_meeting_data(meeting *meeting_data, participant_data *participant_data_array, odas_data *odas_data_array)
-{
+	close(epoll_fd);
+	free(odas_data_array);
+}
 
-	int i;
+//
+// Replay
+//
 
-	// initialise meeting array
-	for (i = 0; i < MAXPART; i++)
+// Feeds a recording through the same parse, process_sound_data and payload building as the live path, without the BLE
+// server, the socket or the ingest thread.  Frames are spaced out as they arrived divided by speed, or sent through as
+// fast as they will go when speed is 0, which makes a replay at max speed the throughput benchmark for the whole path
+static int replay_recording(const char *filename, double speed, odas_parser parse, int num_sources, int max_participants,
+							 const meeting_tuning *tuning)
+{
+	recording_reader reader;
+	meeting meeting_data;
+	participant_data *participant_data_array;
+	odas_data parse_target[MAXCHANNELS];
+	odas_data odas_data_array[MAXCHANNELS];
+	odas_frame frame;
+	char input_buffer[MAXLINE];
+	char payload[MAXPAYLOAD];
+	char real_time[32];
+	const char *datagram;
+	int length, payload_length, format = serverDataFormat.load(), frame_sources, meetings = 0;
+	uint32_t gap_us;
+	unsigned long time_stamp = 0, frames = 0, datagram_bytes = 0, payload_bytes = 0;
+	long long recorded_us = 0, elapsed_us, due_ns;
+	struct timespec start, due, end;
+
+	if (!recording_open(&reader, filename))
 	{
-		participant_data_array[i].participant_angle = 0;
-		participant_data_array[i].participant_is_talking = 0;
-		participant_data_array[i].participant_silent_time = 0;
-		participant_data_array[i].participant_total_talk_time = 0;
-		participant_data_array[i].participant_num_turns = 0;
-		participant_data_array[i].participant_frequency = 150.0;
+		LogFatal((std::string("Unable to open the recording ") + filename).c_str());
+		return -1;
 	}
-
-	for (i = 0; i < NUMCHANNELS; i++)
+	if (!allocate_meeting_data(&meeting_data, &participant_data_array, max_participants) || !payload_delta_init(&serverDataDelta, max_participants))
 	{
-		odas_data_array[i].x = 0.0;
-		odas_data_array[i].y = 0.0;
-		odas_data_array[i].activity = 0.0;
-		odas_data_array[i].frequency = 0.0;
+		LogFatal("Unable to allocate the participant pool");
+		recording_close(&reader);
+		return -1;
 	}
+	memset(parse_target, 0, sizeof(parse_target));
+	initialise_meeting_data(&meeting_data, participant_data_array, odas_data_array);
+	meeting_data.num_channels = num_sources;
+	meeting_data.tuning = *tuning;
 
-	for (i = 0; i < 360; i++)
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (recording_next(&reader, &datagram, &length, &gap_us))
 	{
-		meeting_data->participant_number[i] = 0;
-	}
-
-	meeting_data->total_silence = 0;
-	meeting_data->total_meeting_time = 0;
-	meeting_data->num_participants = 0;
-	meeting_data->last_talker = 0;
-	meeting_data->num_talking = 0;
-}
+		recorded_us += gap_us;
+		if (speed > 0)
+		{
+			due_ns = start.tv_nsec + (long long)(recorded_us * 1000 / speed);
+			due.tv_sec = start.tv_sec + due_ns / 1000000000LL;
+			due.tv_nsec = due_ns % 1000000000LL;
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL);
+		}
 
-void write_to_file(std::string buffer)
-{
+		// exactly what the ingest thread does with a datagram
+		length = length < MAXLINE ? length : MAXLINE - 1;
+		memcpy(input_buffer, datagram, length);
+		input_buffer[length] = 0x00;
+		frame_sources = parse(input_buffer, parse_target, MAXCHANNELS, &time_stamp);
+		memcpy(frame.source, parse_target, sizeof(frame.source));
+		frame.num_sources = frame_sources < MAXCHANNELS ? frame_sources : MAXCHANNELS;
+		if (num_sources == 0 && frame.num_sources > meeting_data.num_channels)
+		{
+			meeting_data.num_channels = frame.num_sources;
+		}
 
-	struct tm *timenow;
-	std::string filename = "MP_";
+		// and then the analytics thread, publishing every frame in whichever format was asked for
+		process_sound_data(&meeting_data, participant_data_array, frame.source, time_stamp);
+		switch (format)
+		{
+		case PAYLOAD_DELTA:
+			payload_length = build_payload_delta(payload, MAXPAYLOAD, &serverDataDelta, &meeting_data, participant_data_array);
+			break;
+		case PAYLOAD_BINARY:
+			payload_length = build_payload_binary(payload, MAXPAYLOAD, &meeting_data, participant_data_array);
+			break;
+		default:
+			payload_length = build_payload_text(payload, MAXPAYLOAD, &meeting_data, participant_data_array);
+			break;
+		}
+		payload_bytes += payload_length > 0 ? payload_length : 0;
+		if (logLevel <= Verbose && payload_length > 0 && format != PAYLOAD_BINARY)
+		{
+			printf("%s\n", payload);
+		}
 
-	time_t now = time(NULL);
-	timenow = gmtime(&now);
-	filename += std::to_string(now);
+		if (meeting_is_over(&meeting_data))
+		{
+			build_payload_text(payload, MAXPAYLOAD, &meeting_data, participant_data_array);
+			printf("%s\n", payload);
+			++meetings;
+			initialise_meeting_data(&meeting_data, participant_data_array, odas_data_array);
+			payload_delta_reset(&serverDataDelta);
+		}
+		++frames;
+		datagram_bytes += length;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
 
-	std::ofstream file(filename);
-//	std::cin >> buffer;
-	file << buffer;
-	file.close();
+	// a recording that stops mid meeting still shows where it had got to
+	if (meeting_data.num_participants > 0)
+	{
+		build_payload_text(payload, MAXPAYLOAD, &meeting_data, participant_data_array);
+		printf("%s\n", payload);
+		++meetings;
+	}
 
+	elapsed_us = (end.tv_sec - start.tv_sec) * 1000000LL + (end.tv_nsec - start.tv_nsec) / 1000;
+	elapsed_us = elapsed_us > 0 ? elapsed_us : 1;
+	snprintf(real_time, sizeof(real_time), "%.1f", (double)recorded_us / elapsed_us);
+	LogStatus((std::string("replay: ") + std::to_string(frames) + " frames, " + std::to_string(meetings) + " meetings, " +
+			   std::to_string(elapsed_us / 1000) + "ms for " + std::to_string(recorded_us / 1000) + "ms recorded (" +
+			   real_time + "x real time), " + std::to_string(frames * 1000000ULL / elapsed_us) + " frames/s, " +
+			   std::to_string(datagram_bytes / elapsed_us) + "MB/s, " +
+			   std::to_string(frames > 0 ? elapsed_us * 1000 / (long long)frames : 0) + "ns/frame, " +
+			   std::to_string(payload_bytes / (frames > 0 ? frames : 1)) + " payload bytes/frame").c_str());
+
+	payload_delta_free(&serverDataDelta);
+	free_meeting_data(&meeting_data, participant_data_array);
+	recording_close(&reader);
+	return 0;
 }
 
 //
@@ -371,6 +627,33 @@ void write_to_file(std::string buffer)
 int main(int argc, char **ppArgv)
 {
 
+	// read frames with recvmmsg (and, with a publish rate of 0, publish once per batch rather than once per frame)
+	bool batch_ingest = false;
+
+	// how many times a second the meeting state is published, 0 for every frame
+	int publish_rate = PUBLISHHZ;
+
+	// odas frames go through the allocation free sst parser unless -j asks for the json-c one
+	odas_parser parse = sst_parse;
+
+	// how many participants the pool has room for
+	int max_participants = MAXPART;
+
+	// odas sources in each frame, 0 to take it from the stream
+	int num_sources = 0;
+	const char *journal_file = NULL;
+
+	// --record captures what odas sends as it is running; --replay runs a capture back through instead, at --speed
+	// times the pace it was recorded at (0 for as fast as it will go)
+	const char *record_file = NULL;
+	const char *replay_file = NULL;
+	double replay_speed = 1.0;
+
+	// thresholds from -c, or from TUNINGFILE if there is one
+	const char *tuning_file = NULL;
+	meeting_tuning tuning;
+	int tuning_error;
+
 	// A basic command-line parser
 	for (int i = 1; i < argc; ++i)
 	{
@@ -387,18 +670,111 @@ int main(int argc, char **ppArgv)
 		{
 			logLevel = Debug;
 		}
+		else if (arg == "-b")
+		{
+			batch_ingest = true;
+		}
+		else if (arg == "-u")
+		{
+			serverDataFormat = PAYLOAD_DELTA;
+		}
+		else if (arg == "-r" && i + 1 < argc)
+		{
+			publish_rate = atoi(ppArgv[++i]);
+			if (publish_rate < 0 || publish_rate > 50)
+			{
+				LogFatal("Publish rate must be between 0 and 50 per second");
+				return -1;
+			}
+		}
+		else if (arg == "-j")
+		{
+			parse = json_parse;
+		}
+		else if (arg == "-s" && i + 1 < argc)
+		{
+			num_sources = atoi(ppArgv[++i]);
+			if (num_sources < 1 || num_sources > MAXCHANNELS)
+			{
+				LogFatal((std::string("Sources must be between 1 and ") + std::to_string(MAXCHANNELS)).c_str());
+				return -1;
+			}
+		}
+		else if (arg == "-J" && i + 1 < argc)
+		{
+			journal_file = ppArgv[++i];
+		}
+		else if (arg == "-c" && i + 1 < argc)
+		{
+			tuning_file = ppArgv[++i];
+		}
+		else if (arg == "--record" && i + 1 < argc)
+		{
+			record_file = ppArgv[++i];
+		}
+		else if (arg == "--replay" && i + 1 < argc)
+		{
+			replay_file = ppArgv[++i];
+		}
+		else if (arg == "--speed" && i + 1 < argc)
+		{
+			std::string speed = ppArgv[++i];
+			replay_speed = speed == "max" ? 0.0 : atof(speed.c_str());
+			if (speed != "max" && replay_speed <= 0.0)
+			{
+				LogFatal("Speed must be a positive number or 'max'");
+				return -1;
+			}
+		}
+		else if (arg == "-p" && i + 1 < argc)
+		{
+			max_participants = atoi(ppArgv[++i]);
+			if (max_participants < 1 || max_participants > MAXPOOL)
+			{
+				LogFatal((std::string("Participants must be between 1 and ") + std::to_string(MAXPOOL)).c_str());
+				return -1;
+			}
+		}
 		else
 		{
 			LogFatal((std::string("Unknown parameter: '") + arg + "'").c_str());
 			LogFatal("");
-			LogFatal("Usage: standalone [-q | -v | -d]");
+			LogFatal("Usage: meetpie [-q | -v | -d] [-b] [-j] [-u] [-r publish rate] [-p max participants] [-s sources] [-J journal file] [-c config file]");
+			LogFatal("               [--record file | --replay file [--speed N|max]]");
 			return -1;
 		}
 	}
 
+	default_tuning(&tuning);
+	tuning_error = tuning_load(&tuning, tuning_file != NULL ? tuning_file : TUNINGFILE);
+	if (tuning_error > 0 || (tuning_error < 0 && tuning_file != NULL))
+	{
+		LogFatal((std::string("Unable to read ") + (tuning_file != NULL ? tuning_file : TUNINGFILE) +
+				  (tuning_error > 0 ? ", line " + std::to_string(tuning_error) + " is not a threshold meetpie knows" : "")).c_str());
+		return -1;
+	}
+	if (tuning_error == 0)
+	{
+		LogStatus((std::string("thresholds from ") + (tuning_file != NULL ? tuning_file : TUNINGFILE) + ": min_energy " +
+				   std::to_string(tuning.min_energy) + ", angle_spread " + std::to_string(tuning.angle_spread) + ", min_talk_time " +
+				   std::to_string(tuning.min_talk_time) + ", max_silence " + std::to_string(tuning.max_silence)).c_str());
+	}
+
+	// a replay needs none of the bluetooth, socket or thread setup below
+	if (replay_file != NULL)
+	{
+		return replay_recording(replay_file, replay_speed, parse, num_sources, max_participants, &tuning);
+	}
+
 	// Setup our signal handlers
-	signal(SIGINT, signalHandler);
-	signal(SIGTERM, signalHandler);
+	//
+	// SIGINT and SIGTERM are blocked here (before ggkStart creates its threads, so they inherit the mask) and delivered
+	// through a signalfd instead, which lets the main loop sleep in epoll_wait and still wake up for a shutdown request
+	sigset_t signal_mask;
+	sigemptyset(&signal_mask);
+	sigaddset(&signal_mask, SIGINT);
+	sigaddset(&signal_mask, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signal_mask, NULL);
 
 	// Register our loggers
 	ggkLogRegisterDebug(LogDebug);
@@ -410,17 +786,14 @@ int main(int argc, char **ppArgv)
 	ggkLogRegisterAlways(LogAlways);
 	ggkLogRegisterTrace(LogTrace);
 
-	//SD reserve space for json string to improve performance
-	serverDataTextString.reserve(MAXLINE);
+	snapshot_init(&serverDataTextSnapshot);
 
 	//SD
 	//Create and bind UDP socket to get data from odas server
 
 	// first declare UDP variables
 	int in_sockfd;
-	int bytes_returned;
 	struct sockaddr_in in_addr;
-	char input_buffer[MAXLINE];
 
 	// Create socket file descriptor for server
 	if ((in_sockfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
@@ -441,16 +814,135 @@ int main(int argc, char **ppArgv)
 		return -1;
 	}
 
-	socklen_t len;
-	len = sizeof(in_addr); //length data is neeeded for receive call
+	// the ingest thread receives and parses, and hands frames over through the ring.  frames_fd is how it wakes
+	// us up and stop_fd is how we tell it to finish
+	static odas_ring ring;
+	ingest_state ingest;
+	odas_frame frame;
+	// publish scheduling - with a publish rate the latest state goes out on publish_fd's timer, and straight away only
+	// for a new participant or a change of turn.  Either way nothing is sent while the server's update queue is deep
+	bool publish_pending = false;
+	bool publish_now = false;
+	int last_registered = 0;
+	int last_talker = NOPARTICIPANT;
+	unsigned long publishes_deferred = 0;
+
+	odas_ring_init(&ring);
+	memset(&ingest, 0, sizeof(ingest));
+	ingest.sockfd = in_sockfd;
+	ingest.batch_ingest = batch_ingest;
+	ingest.parse = parse;
+	ingest.ring = &ring;
+
+	if ((ingest.frames_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0 || (ingest.stop_fd = eventfd(0, EFD_CLOEXEC)) < 0)
+	{
+		LogFatal("Error creating eventfd");
+		return -1;
+	}
+
+	// event loop plumbing - the main loop only wakes when the ingest thread has frames for us, a signal arrives or the timer ticks
+	int signal_fd, timer_fd, publish_fd, epoll_fd;
+	int num_events, e;
+	int ticks = 0;
+	struct epoll_event event;
+	struct epoll_event events[MAXEVENTS];
+	struct signalfd_siginfo signal_info;
+	struct itimerspec timer_spec;
+	uint64_t timer_expirations, frames_signalled;
+
+	if ((signal_fd = signalfd(-1, &signal_mask, SFD_NONBLOCK | SFD_CLOEXEC)) < 0)
+	{
+		LogFatal("Error creating signalfd");
+		return -1;
+	}
+
+	// periodic work (shutdown checks etc) runs off this timer rather than off the arrival of udp frames
+	if ((timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
+	{
+		LogFatal("Error creating timerfd");
+		return -1;
+	}
+	timer_spec.it_interval.tv_sec = TICKMS / 1000;
+	timer_spec.it_interval.tv_nsec = (TICKMS % 1000) * 1000000L;
+	timer_spec.it_value = timer_spec.it_interval;
+	if (timerfd_settime(timer_fd, 0, &timer_spec, NULL) < 0)
+	{
+		LogFatal("Error setting timerfd");
+		return -1;
+	}
+
+	if ((publish_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
+	{
+		LogFatal("Error creating timerfd");
+		return -1;
+	}
+	if (publish_rate > 0)
+	{
+		// tv_nsec has to stay below a second, which -r 1 would not
+		timer_spec.it_interval.tv_sec = 1 / publish_rate;
+		timer_spec.it_interval.tv_nsec = (1000000000L / publish_rate) % 1000000000L;
+		timer_spec.it_value = timer_spec.it_interval;
+		if (timerfd_settime(publish_fd, 0, &timer_spec, NULL) < 0)
+		{
+			LogFatal("Error setting the publish timerfd");
+			return -1;
+		}
+	}
+
+	if ((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+	{
+		LogFatal("Error creating epoll instance");
+		return -1;
+	}
+
+	event.events = EPOLLIN;
+	event.data.fd = ingest.frames_fd;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ingest.frames_fd, &event);
+	event.data.fd = signal_fd;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &event);
+	event.data.fd = timer_fd;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &event);
+	event.data.fd = publish_fd;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, publish_fd, &event);
 
 	// initialise all meeting data variables
 	// initialise arrays for input and output data
 
 	meeting meeting_data;	   // "meeting" is a  custom type
-	participant_data *participant_data_array = (participant_data *)malloc(MAXPART * sizeof(participant_data)); // "participant data" is a struct
-	odas_data *odas_data_array = (odas_data *)malloc(NUMCHANNELS * sizeof(odas_data));					   // "odas data" is a struct
+	participant_data *participant_data_array;
+	if (!allocate_meeting_data(&meeting_data, &participant_data_array, max_participants) || !payload_delta_init(&serverDataDelta, max_participants))
+	{
+		LogFatal("Unable to allocate the participant pool");
+		return -1;
+	}
+	odas_data *odas_data_array = (odas_data *)malloc(MAXCHANNELS * sizeof(odas_data));					   // "odas data" is a struct
 	initialise_meeting_data(&meeting_data, participant_data_array, odas_data_array);					   // set everything to zero
+	meeting_data.num_channels = num_sources;
+	meeting_data.tuning = tuning;
+
+	if (!archive_init(&meetingArchive))
+	{
+		LogFatal("Error creating the archive writer's eventfd");
+		return -1;
+	}
+	if (journal_file != NULL)
+	{
+		if (!journal_open_writer(&meetingJournal, journal_file))
+		{
+			LogFatal((std::string("Unable to open the journal ") + journal_file).c_str());
+			return -1;
+		}
+		journalling = true;
+	}
+	if (record_file != NULL)
+	{
+		if (!recording_open_writer(&odasRecording, record_file))
+		{
+			LogFatal((std::string("Unable to open the recording ") + record_file).c_str());
+			return -1;
+		}
+		ingest.recording = &odasRecording;
+	}
 
 	// need to change the main to poll gpio to test for reset
 
@@ -469,106 +961,218 @@ int main(int argc, char **ppArgv)
 		return -1;
 	}
 
+	std::thread ingest_thread(ingest_odas_data, &ingest);
+	std::thread archive_thread(archive_writer, &meetingArchive);
+	std::thread journal_thread;
+	if (journalling)
+	{
+		journal_thread = std::thread(journal_writer_run, &meetingJournal);
+	}
+	std::thread recording_thread;
+	if (ingest.recording != NULL)
+	{
+		recording_thread = std::thread(recording_writer_run, &odasRecording);
+	}
+
 	// Wait for the server to start the shutdown process
 	//
-	// While we wait, every 15 ticks, drop the battery level by one percent until we reach 0
+	// This is the analytics thread.  It sleeps in epoll_wait until the ingest thread signals that there are frames in the
+	// ring, a signal arrives or the periodic timer fires, so an idle meeting room costs no cpu
 	while (ggkGetServerRunState() < EStopping)
 	{
+		num_events = epoll_wait(epoll_fd, events, MAXEVENTS, -1);
 
-		//this is main polling loop for getting data from odas via UDP receive
-		//it processes this data and then updates the bluetooth characteristic with new data
-
-		bytes_returned = recvfrom(in_sockfd, (char *)input_buffer, MAXLINE,
-								  MSG_DONTWAIT, (struct sockaddr *)&in_addr,
-								  &len);
-
-		if (bytes_returned > 0)
+		if (num_events < 0)
 		{
-//			printf("got %d bytes\n", bytes_returned);
-			input_buffer[bytes_returned] = 0x00; // sets end for json parser
-			printf(input_buffer);
-			json_parse(input_buffer, odas_data_array);		
-//			printf("got past parsing");
-			process_sound_data(&meeting_data, participant_data_array, odas_data_array);
-
-			// build the string for the server
-			// load data into shared buffer space for the data getter
-			// first lock the mutex
-
-			mutex_buffer.lock();
-
-		// is this needed ?
-			serverDataTextString = "{\"tMT\": ";
-			serverDataTextString += std::to_string(meeting_data.total_meeting_time);
-			serverDataTextString += ",\n\"m\": [\n";
-
-			int i;
-			for (i = 1; i < MAXPART; i++)
+			if (errno == EINTR)
 			{
+				continue;
+			}
+			LogFatal("epoll_wait failed");
+			ggkTriggerShutdown();
+			break;
+		}
 
+		for (e = 0; e < num_events; e++)
+		{
+			if (events[e].data.fd == signal_fd)
+			{
+				while (read(signal_fd, &signal_info, sizeof(signal_info)) == sizeof(signal_info))
+				{
+					signalHandler(signal_info.ssi_signo);
+				}
+			}
+			else if (events[e].data.fd == timer_fd)
+			{
+				read(timer_fd, &timer_expirations, sizeof(timer_expirations));
 
-				serverDataTextString += "[";
-				serverDataTextString += std::to_string(participant_data_array[i].participant_angle);
-				serverDataTextString += ",";
-				serverDataTextString += std::to_string(participant_data_array[i].participant_is_talking);
-				serverDataTextString += ",";
-				serverDataTextString += std::to_string(participant_data_array[i].participant_num_turns);
-				serverDataTextString += ",";
-				serverDataTextString += std::to_string(participant_data_array[i].participant_total_talk_time);
-				serverDataTextString += "]";
-
-
-// new logic by sd to calc turns using energy 
-
-				if (participant_data_array[i].participant_is_talking == 1 && meeting_data.num_talking == 1) 
+				if (++ticks % STATSTICKS == 0 && logLevel <= Verbose)
 				{
-					if (meeting_data.last_talker!=i) // its a change of turn
+					LogInfo((std::string("ring occupancy ") + std::to_string(odas_ring_occupancy(&ring)) + "/" + std::to_string(RINGSIZE) +
+							 ", high water " + std::to_string(ring.high_water.load()) + ", overflows " + std::to_string(ring.overflows.load()) +
+							 ", frames lost this meeting " + std::to_string(meeting_data.lost_frames) + " in " + std::to_string(meeting_data.frame_gaps) + " gaps").c_str());
+					LogInfo((std::string("archive queue ") + std::to_string(archive_depth(&meetingArchive)) + "/" + std::to_string(ARCHIVEQUEUE) +
+							 ", high water " + std::to_string(meetingArchive.high_water.load()) + ", last write " +
+							 std::to_string(meetingArchive.last_write_us.load() / 1000) + "ms, slowest " + std::to_string(meetingArchive.max_write_us.load() / 1000) +
+							 "ms, dropped " + std::to_string(meetingArchive.dropped.load()) + ", failed " + std::to_string(meetingArchive.failed.load())).c_str());
+					if (journalling)
 					{
-						++participant_data_array[i].participant_num_turns;
-						meeting_data.last_talker = i;
+						LogInfo((std::string("journal ") + std::to_string(meetingJournal.blocks_written.load()) + " blocks, slowest write " +
+								 std::to_string(meetingJournal.max_write_us.load() / 1000) + "ms, dropped " + std::to_string(meetingJournal.dropped.load()) +
+								 " frames").c_str());
 					}
 				}
 
-				participant_data_array[i].participant_is_talking = 0; // set everyone to not talking
-// end of new turn logic
+		//		sd need to change the battery level to be real - from PiJuice
+		//		serverDataBatteryLevel = std::max(serverDataBatteryLevel - 1, 0);
+		//		ggkNofifyUpdatedCharacteristic("/com/gobbledegook/battery/level");
+			}
+			else if (events[e].data.fd == publish_fd)
+			{
+				// the regular publish - only if something has changed and the server is keeping up
+				read(publish_fd, &timer_expirations, sizeof(timer_expirations));
 
-				if (i < MAXPART-1)
+				if (publish_pending)
 				{
-					serverDataTextString += ",";
+					if (update_queue_is_deep())
+					{
+						++publishes_deferred;
+					}
+					else
+					{
+						publish_meeting_data(&meeting_data, participant_data_array);
+						publish_pending = false;
+						publish_now = false;
+					}
 				}
 			}
+			else if (events[e].data.fd == ingest.frames_fd)
+			{
+				// the eventfd only says there is something in the ring - we take everything that is there now
+				read(ingest.frames_fd, &frames_signalled, sizeof(frames_signalled));
 
-			serverDataTextString += "]}\n";
+				while (odas_ring_pop(&ring, &frame))
+				{
+					// without -s we look at as many sources as odas has sent in any frame so far
+					if (num_sources == 0 && frame.num_sources > meeting_data.num_channels)
+					{
+						meeting_data.num_channels = frame.num_sources;
+						LogInfo((std::string("odas is sending ") + std::to_string(frame.num_sources) + " sources").c_str());
+					}
 
+					process_sound_data(&meeting_data, participant_data_array, frame.source, frame.time_stamp);
+					publish_pending = true;
+					if (journalling && meeting_data.num_participants > 0)
+					{
+						journal_record(&meetingJournal, &meeting_data, participant_data_array);
+					}
 
-			mutex_buffer.unlock();
+					// a new participant or a change of turn is worth telling clients about straight away
+					if (meeting_data.participants_registered != last_registered || meeting_data.last_talker != last_talker)
+					{
+						publish_now = true;
+						last_registered = meeting_data.participants_registered;
+						last_talker = meeting_data.last_talker;
+					}
 
-		    	printf ("%s\n",serverDataTextString.c_str());
+					// without a publish rate every frame is published as before, unless -b asked for once per batch
+					if (publish_rate == 0 && !batch_ingest)
+					{
+						publish_meeting_data(&meeting_data, participant_data_array);
+						publish_pending = false;
+					}
 
-		// now the output string is ready and we should call notify
-			ggkNofifyUpdatedCharacteristic("/com/gobbledegook/text/string");
+					if (meeting_is_over(&meeting_data))
+					{
+						// clients always see the final state of a meeting before it is reset
+						if (publish_pending)
+						{
+							publish_meeting_data(&meeting_data, participant_data_array);
+						}
+						end_meeting(&meeting_data, participant_data_array, odas_data_array);
+						last_registered = 0;
+						last_talker = NOPARTICIPANT;
+						publish_pending = true;
+					}
+				}
 
-			if (meeting_data.total_silence > MAXSILENCE)
-			{
-				// reset all the meeting stuff and write to file
-				if (meeting_data.num_participants > 0)
+				if (publish_pending && (publish_rate == 0 || (publish_now && !update_queue_is_deep())))
 				{
-					mutex_buffer.lock();
-					write_to_file(serverDataTextString);
-					mutex_buffer.unlock();
-
-				// reset data for next meeting
-					initialise_meeting_data(&meeting_data, participant_data_array, odas_data_array);
+					publish_meeting_data(&meeting_data, participant_data_array);
+					publish_pending = false;
+					publish_now = false;
 				}
 			}
-		//		std::this_thread::sleep_for(std::chrono::seconds(2));
-
-		//		sd need to change the battery level to be real - from PiJuice
-		//		serverDataBatteryLevel = std::max(serverDataBatteryLevel - 1, 0);
-		//		ggkNofifyUpdatedCharacteristic("/com/gobbledegook/battery/level");
 		}
 	}
 
+	// let the ingest thread finish before we tear down what it uses
+	uint64_t stop = 1;
+	write(ingest.stop_fd, &stop, sizeof(stop));
+	ingest_thread.join();
+
+	// then the recorder can have the last of what it captured
+	if (ingest.recording != NULL)
+	{
+		recording_flush(&odasRecording);
+		recording_stop(&odasRecording);
+		recording_thread.join();
+	}
+
+	// and the archive writer finish whatever meetings it still has queued
+	archive_stop(&meetingArchive);
+	archive_thread.join();
+	if (journalling)
+	{
+		journal_stop(&meetingJournal);
+		journal_thread.join();
+	}
+
+	if (batch_ingest && ingest.batch_wakeups > 0)
+	{
+		LogStatus((std::string("batched ingest: ") + std::to_string(ingest.batch_frames) + " frames in " + std::to_string(ingest.batch_wakeups) +
+				   " wakeups, largest batch " + std::to_string(ingest.batch_max_frames)).c_str());
+	}
+	if (publishes_deferred > 0)
+	{
+		LogStatus((std::string("publishes deferred for a deep update queue: ") + std::to_string(publishes_deferred)).c_str());
+	}
+	LogStatus((std::string("ring: ") + std::to_string(ring.pushed.load()) + " frames, high water " + std::to_string(ring.high_water.load()) +
+			   "/" + std::to_string(RINGSIZE) + ", overflows " + std::to_string(ring.overflows.load())).c_str());
+	if (meetingArchive.queued.load() > 0)
+	{
+		LogStatus((std::string("archive: ") + std::to_string(meetingArchive.written.load()) + " meetings written, " +
+				   std::to_string(meetingArchive.failed.load()) + " failed, " + std::to_string(meetingArchive.dropped.load()) + " dropped, write " +
+				   std::to_string(meetingArchive.total_write_us.load() / 1000 / (long long)meetingArchive.queued.load()) + "ms average " +
+				   std::to_string(meetingArchive.max_write_us.load() / 1000) + "ms slowest, queue high water " +
+				   std::to_string(meetingArchive.high_water.load()) + "/" + std::to_string(ARCHIVEQUEUE) + ", longest wait " +
+				   std::to_string(meetingArchive.max_wait_us.load() / 1000) + "ms").c_str());
+	}
+
+	if (ingest.recording != NULL)
+	{
+		LogStatus((std::string("recording: ") + std::to_string(odasRecording.frames) + " datagrams, " + std::to_string(odasRecording.bytes) +
+				   " bytes, " + std::to_string(odasRecording.dropped.load()) + " dropped, " + std::to_string(odasRecording.failed.load()) +
+				   " writes failed, slowest write " + std::to_string(odasRecording.max_write_us.load() / 1000) + "ms").c_str());
+		recording_close_writer(&odasRecording);
+	}
+	if (journalling)
+	{
+		LogStatus((std::string("journal: ") + std::to_string(meetingJournal.records) + " frames in " + std::to_string(meetingJournal.blocks_written.load()) +
+				   " blocks, " + std::to_string(meetingJournal.failed.load()) + " failed, " + std::to_string(meetingJournal.dropped.load()) +
+				   " frames dropped, slowest write " + std::to_string(meetingJournal.max_write_us.load() / 1000) + "ms").c_str());
+		journal_close_writer(&meetingJournal);
+	}
+
+	close(epoll_fd);
+	close(timer_fd);
+	close(publish_fd);
+	close(signal_fd);
+	close(ingest.frames_fd);
+	close(ingest.stop_fd);
+	close(in_sockfd);
+	archive_close(&meetingArchive);
+
 	// Wait for the server to come to a complete stop (CTRL-C from the command line)
 	if (!ggkWait())
 	{
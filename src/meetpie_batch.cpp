@@ -0,0 +1,393 @@
+//
+//  meetpie_batch.cpp
+//
+//  offline reprocessing of recorded sessions (see recording.cpp).  Every recording in a directory goes
+//  through the same parse and process_sound_data as a live meetpie, each on meeting state of its own,
+//  spread over a thread per core.  Each meeting found is printed as the summary meetpie would have
+//  archived for it, one line per meeting in recording name order, and the totals go to stderr.
+//  It links none of the bluetooth code so it runs anywhere json-c is installed.
+//
+//  usage: meetpie_batch [-t threads] [-j] [-p max participants] [-s sources] [-c config file] directory
+//
+//  recordings are dealt out largest first.  A thread that has finished its own share takes the back
+//  half of whatever is left of the largest remaining share, so one long session cannot leave the
+//  other cores idle at the end of the night
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "../include/meetpie.h"
+#include "../include/json_parsing.h"
+#include "../include/payload.h"
+#include "../include/snapshot.h"
+#include "../include/recording.h"
+#include "../include/tuning.h"
+
+typedef struct batch_job{
+    std::string name;
+    unsigned long size;
+    std::string summary;                // a line for each meeting
+    unsigned long frames;
+    int meetings;
+    bool ok;
+ } batch_job;
+
+// a thread's share of the jobs is a range of positions in the deal.  It is kept as first and end in one word so the
+// owner taking from the front and a thief taking from the back can never both get the same job
+typedef struct batch_worker{
+    alignas(64) std::atomic<uint64_t> range;
+    // only the worker's own thread writes these, and they are read once it has been joined
+    unsigned long jobs;
+    unsigned long steals;
+    unsigned long frames;
+ } batch_worker;
+
+// what every thread shares.  Nothing in it is written once the threads have started apart from each job's own results,
+// which only the thread that took the job writes
+typedef struct batch_state{
+    std::vector<batch_job> jobs;
+    std::vector<unsigned int> deal;     // job for each position - the threads' ranges are ranges of positions
+    std::vector<batch_worker> workers;
+    odas_parser parse;
+    int num_sources;
+    int max_participants;
+    meeting_tuning tuning;
+ } batch_state;
+
+static bool name_order(const batch_job &a, const batch_job &b)
+{
+	return a.name < b.name;
+}
+
+static uint64_t make_range(uint32_t first, uint32_t end)
+{
+	return (uint64_t)first << 32 | end;
+}
+
+// the next job from the front of a thread's own range
+static bool take_own(batch_worker *worker, unsigned int *position)
+{
+	uint64_t range = worker->range.load(std::memory_order_acquire);
+	uint32_t first, end;
+
+	do
+	{
+		first = range >> 32;
+		end = (uint32_t)range;
+		if (first >= end)
+		{
+			return false;
+		}
+	} while (!worker->range.compare_exchange_weak(range, make_range(first + 1, end), std::memory_order_acq_rel));
+
+	*position = first;
+	return true;
+}
+
+// moves the back half of the largest range left onto the thief's own, which is empty.  Returns false when every range is
+static bool steal(batch_state *state, batch_worker *thief)
+{
+	batch_worker *victim;
+	uint64_t range;
+	uint32_t first, end, left, most, half;
+	size_t w;
+
+	for (;;)
+	{
+		victim = NULL;
+		most = 0;
+		for (w = 0; w < state->workers.size(); w++)
+		{
+			range = state->workers[w].range.load(std::memory_order_acquire);
+			left = (uint32_t)range > (range >> 32) ? (uint32_t)range - (range >> 32) : 0;
+			if (left > most)
+			{
+				most = left;
+				victim = &state->workers[w];
+			}
+		}
+		if (victim == NULL)
+		{
+			return false;
+		}
+
+		range = victim->range.load(std::memory_order_acquire);
+		first = range >> 32;
+		end = (uint32_t)range;
+		if (first >= end)
+		{
+			continue;
+		}
+		half = (end - first + 1) / 2;
+		if (victim->range.compare_exchange_strong(range, make_range(first, end - half), std::memory_order_acq_rel))
+		{
+			thief->range.store(make_range(end - half, end), std::memory_order_release);
+			++thief->steals;
+			return true;
+		}
+	}
+}
+
+// the meeting's archive text, on one line after the recording's name and the meeting's number in it
+static void add_summary(batch_job *job, const meeting *meeting_data, const participant_data *participant_data_array)
+{
+	char payload[MAXPAYLOAD];
+	int length = build_payload_text(payload, MAXPAYLOAD, meeting_data, participant_data_array), c;
+
+	job->summary += job->name + " " + std::to_string(++job->meetings) + " ";
+	for (c = 0; c < length; c++)
+	{
+		if (payload[c] != '\n')
+		{
+			job->summary += payload[c];
+		}
+	}
+	job->summary += '\n';
+}
+
+// one recording, start to finish, exactly as meetpie would have seen it live
+static void run_job(batch_state *state, batch_job *job, meeting *meeting_data, participant_data *participant_data_array,
+					odas_data *parse_target, odas_data *odas_data_array)
+{
+	recording_reader reader;
+	odas_frame frame;
+	char input_buffer[MAXLINE];
+	const char *datagram;
+	int length, frame_sources;
+	uint32_t gap_us;
+	unsigned long time_stamp = 0;
+
+	job->frames = 0;
+	job->meetings = 0;
+	if (!(job->ok = recording_open(&reader, job->name.c_str())))
+	{
+		return;
+	}
+
+	memset(parse_target, 0, MAXCHANNELS * sizeof(odas_data));
+	initialise_meeting_data(meeting_data, participant_data_array, odas_data_array);
+	meeting_data->num_channels = state->num_sources;
+	meeting_data->tuning = state->tuning;
+
+	while (recording_next(&reader, &datagram, &length, &gap_us))
+	{
+		length = length < MAXLINE ? length : MAXLINE - 1;
+		memcpy(input_buffer, datagram, length);
+		input_buffer[length] = 0x00;
+		frame_sources = state->parse(input_buffer, parse_target, MAXCHANNELS, &time_stamp);
+		memcpy(frame.source, parse_target, sizeof(frame.source));
+		frame.num_sources = frame_sources < MAXCHANNELS ? frame_sources : MAXCHANNELS;
+		if (state->num_sources == 0 && frame.num_sources > meeting_data->num_channels)
+		{
+			meeting_data->num_channels = frame.num_sources;
+		}
+
+		process_sound_data(meeting_data, participant_data_array, frame.source, time_stamp);
+		++job->frames;
+
+		if (meeting_is_over(meeting_data))
+		{
+			add_summary(job, meeting_data, participant_data_array);
+			initialise_meeting_data(meeting_data, participant_data_array, odas_data_array);
+		}
+	}
+
+	// a recording that stops mid meeting still shows where it had got to
+	if (meeting_data->num_participants > 0)
+	{
+		add_summary(job, meeting_data, participant_data_array);
+	}
+	recording_close(&reader);
+}
+
+// a worker thread.  Its meeting state is its own and is reused from one recording to the next
+static void run_worker(batch_state *state, batch_worker *worker)
+{
+	meeting meeting_data;
+	participant_data *participant_data_array;
+	odas_data parse_target[MAXCHANNELS];
+	odas_data odas_data_array[MAXCHANNELS];
+	unsigned int position;
+
+	if (!allocate_meeting_data(&meeting_data, &participant_data_array, state->max_participants))
+	{
+		return;
+	}
+	for (;;)
+	{
+		while (take_own(worker, &position))
+		{
+			run_job(state, &state->jobs[state->deal[position]], &meeting_data, participant_data_array, parse_target, odas_data_array);
+			++worker->jobs;
+			worker->frames += state->jobs[state->deal[position]].frames;
+		}
+		if (!steal(state, worker))
+		{
+			break;
+		}
+	}
+	free_meeting_data(&meeting_data, participant_data_array);
+}
+
+//
+// Entry point
+//
+
+int main(int argc, char **ppArgv)
+{
+	batch_state state;
+	std::string directory;
+	int threads = std::thread::hardware_concurrency();
+	const char *tuning_file = NULL;
+	int i, failed = 0, meetings = 0, tuning_error;
+	unsigned long frames = 0, steals = 0;
+	size_t j, w, position;
+	DIR *dir;
+	struct dirent *entry;
+	struct stat file_stat;
+
+	state.parse = sst_parse;
+	state.num_sources = 0;
+	state.max_participants = MAXPART;
+	default_tuning(&state.tuning);
+
+	for (i = 1; i < argc; ++i)
+	{
+		std::string arg = ppArgv[i];
+		if (arg == "-t" && i + 1 < argc)
+		{
+			threads = atoi(ppArgv[++i]);
+		}
+		else if (arg == "-j")
+		{
+			state.parse = json_parse;
+		}
+		else if (arg == "-s" && i + 1 < argc)
+		{
+			state.num_sources = atoi(ppArgv[++i]);
+		}
+		else if (arg == "-c" && i + 1 < argc)
+		{
+			tuning_file = ppArgv[++i];
+		}
+		else if (arg == "-p" && i + 1 < argc)
+		{
+			state.max_participants = atoi(ppArgv[++i]);
+		}
+		else if (arg[0] != '-' && directory.empty())
+		{
+			directory = arg;
+		}
+		else
+		{
+			directory.clear();
+			break;
+		}
+	}
+	if (directory.empty() || threads < 1 || state.num_sources < 0 || state.num_sources > MAXCHANNELS ||
+		state.max_participants < 1 || state.max_participants > MAXPOOL)
+	{
+		fprintf(stderr, "Usage: meetpie_batch [-t threads] [-j] [-p max participants] [-s sources] [-c config file] directory\n");
+		return -1;
+	}
+
+	// the same thresholds meetpie would start with - the default config file need not exist, one named with -c must
+	tuning_error = tuning_load(&state.tuning, tuning_file != NULL ? tuning_file : TUNINGFILE);
+	if (tuning_error > 0 || (tuning_error < 0 && tuning_file != NULL))
+	{
+		fprintf(stderr, "unable to read thresholds from %s", tuning_file != NULL ? tuning_file : TUNINGFILE);
+		if (tuning_error > 0)
+		{
+			fprintf(stderr, ", line %d is not a threshold meetpie knows", tuning_error);
+		}
+		fprintf(stderr, "\n");
+		return -1;
+	}
+
+	// every regular file in the directory, bar labels and the like, is taken to be a recording - anything else is
+	// reported as failed
+	if ((dir = opendir(directory.c_str())) == NULL)
+	{
+		fprintf(stderr, "unable to open %s\n", directory.c_str());
+		return -1;
+	}
+	while ((entry = readdir(dir)) != NULL)
+	{
+		batch_job job;
+		job.name = directory + "/" + entry->d_name;
+		if (!recording_sidecar(job.name.c_str()) && stat(job.name.c_str(), &file_stat) == 0 && S_ISREG(file_stat.st_mode))
+		{
+			job.size = file_stat.st_size;
+			state.jobs.push_back(job);
+		}
+	}
+	closedir(dir);
+	std::sort(state.jobs.begin(), state.jobs.end(), name_order);
+
+	// deal largest first, round the threads, so each starts with a fair share and the long sessions go early
+	std::vector<std::pair<unsigned long, unsigned int> > by_size;
+	for (j = 0; j < state.jobs.size(); j++)
+	{
+		by_size.push_back(std::make_pair(state.jobs[j].size, (unsigned int)j));
+	}
+	std::sort(by_size.rbegin(), by_size.rend());
+	for (j = 0; j < by_size.size(); j++)
+	{
+		state.deal.push_back(by_size[j].second);
+	}
+	threads = (size_t)threads < state.jobs.size() ? threads : (state.jobs.size() > 0 ? state.jobs.size() : 1);
+	std::vector<unsigned int> dealt;
+	state.workers = std::vector<batch_worker>(threads);
+	for (w = 0; w < (size_t)threads; w++)
+	{
+		state.workers[w].range.store(make_range(dealt.size(), dealt.size() + (state.deal.size() + threads - 1 - w) / threads));
+		state.workers[w].jobs = 0;
+		state.workers[w].steals = 0;
+		state.workers[w].frames = 0;
+		for (position = w; position < state.deal.size(); position += threads)
+		{
+			dealt.push_back(state.deal[position]);
+		}
+	}
+	state.deal = dealt;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::vector<std::thread> pool;
+	for (w = 0; w < (size_t)threads; w++)
+	{
+		pool.push_back(std::thread(run_worker, &state, &state.workers[w]));
+	}
+	for (w = 0; w < pool.size(); w++)
+	{
+		pool[w].join();
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	for (j = 0; j < state.jobs.size(); j++)
+	{
+		if (!state.jobs[j].ok)
+		{
+			fprintf(stderr, "%s is not a recording\n", state.jobs[j].name.c_str());
+			++failed;
+		}
+		fputs(state.jobs[j].summary.c_str(), stdout);
+		meetings += state.jobs[j].meetings;
+	}
+	for (w = 0; w < state.workers.size(); w++)
+	{
+		frames += state.workers[w].frames;
+		steals += state.workers[w].steals;
+		fprintf(stderr, "thread %zu: %lu recordings, %lu frames, %lu steals\n", w, state.workers[w].jobs, state.workers[w].frames, state.workers[w].steals);
+	}
+	fprintf(stderr, "%zu recordings, %d meetings, %lu frames in %.3f s on %d threads - %.0f frames/s, %lu steals\n", state.jobs.size(), meetings,
+			frames, seconds, threads, frames / seconds, steals);
+
+	return failed == 0 ? 0 : 1;
+}
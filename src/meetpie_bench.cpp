@@ -0,0 +1,742 @@
+//
+//  meetpie_bench.cpp
+//
+//  microbenchmarks for the per-frame hot path - parsing, process_sound_data, building the payload
+//  and journalling it.  It links none of the bluetooth code so it runs anywhere json-c is installed.
+//
+//  usage: meetpie_bench [-n iterations] [corpus]
+//
+//  the corpus has one odas SST frame per line (bench/odas_sst_frames.txt by default) and every
+//  benchmark makes <iterations> passes over it.  The checks after the timings each name themselves
+//  if they fail, and the exit code is non zero if any did
+//
+
+#include <chrono>
+#include <unistd.h>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../include/meetpie.h"
+#include "../include/json_parsing.h"
+#include "../include/payload.h"
+#include "../include/bearing.h"
+#include "../include/clustering.h"
+#include "../include/journal.h"
+
+//
+// Allocation counting
+//
+// malloc and friends are replaced for the whole process so allocations made inside json-c are seen
+// as well as our own.  glibc exports its real allocator under the __libc_ names
+
+extern "C"
+{
+void *__libc_malloc(size_t);
+void *__libc_calloc(size_t, size_t);
+void *__libc_realloc(void *, size_t);
+void __libc_free(void *);
+}
+
+static unsigned long allocation_count = 0;
+
+extern "C" void *malloc(size_t size) __THROW
+{
+	++allocation_count;
+	return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size) __THROW
+{
+	++allocation_count;
+	return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size) __THROW
+{
+	++allocation_count;
+	return __libc_realloc(ptr, size);
+}
+
+extern "C" void free(void *ptr) __THROW
+{
+	__libc_free(ptr);
+}
+
+//
+// Timing and reporting
+//
+
+// meeting state captured after each corpus frame so the payload builders can be timed on their own.  The payload
+// builders only look at the meeting's counters, so the meeting's own pointers are left shared with the live one
+typedef struct meeting_snapshot{
+	meeting meeting_data;
+	std::vector<participant_data> participant_data_array;
+ } meeting_snapshot;
+
+// stops the compiler throwing away work whose result we never look at
+static volatile unsigned long bench_sink;
+
+static std::chrono::steady_clock::time_point bench_start;
+static unsigned long bench_allocations;
+
+static void start_bench()
+{
+	bench_allocations = allocation_count;
+	bench_start = std::chrono::steady_clock::now();
+}
+
+static void stop_bench(const char *name, unsigned long frames, unsigned long bytes)
+{
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+	unsigned long allocations = allocation_count - bench_allocations;
+	double seconds = std::chrono::duration<double>(end - bench_start).count();
+
+	printf("%-24s %10.1f ns/frame %8.2f allocs/frame %12.0f frames/s", name, seconds * 1e9 / frames,
+		   (double)allocations / frames, frames / seconds);
+	if (bytes > 0)
+	{
+		printf(" %8.1f MB/s", bytes / seconds / 1e6);
+	}
+	printf("\n");
+}
+
+//
+// Checks
+//
+
+// the numbers in a text payload in the order they appear - tMT, dT and then eight for each participant
+static std::vector<int> text_numbers(const char *text)
+{
+	std::vector<int> numbers;
+	char *end;
+
+	while (*text != 0x00)
+	{
+		if ((*text >= '0' && *text <= '9') || (*text == '-' && text[1] >= '0' && text[1] <= '9'))
+		{
+			numbers.push_back(strtol(text, &end, 10));
+			text = end;
+		}
+		else
+		{
+			++text;
+		}
+	}
+	return numbers;
+}
+
+static int decode_varint(const unsigned char **p, const unsigned char *end)
+{
+	int value = 0, shift = 0;
+
+	while (*p < end && (**p & 0x80) != 0 && shift < 28)
+	{
+		value |= (*(*p)++ & 0x7f) << shift;
+		shift += 7;
+	}
+	return *p < end ? value | *(*p)++ << shift : -1;
+}
+
+// decodes a binary payload the way a client would and holds it up against the text payload for the same state, field
+// by field.  Talk time and energy only have to be within the half step the binary form rounds them to
+static bool binary_matches_text(const char *binary, const char *text)
+{
+	unsigned char raw[BINARYRAWSIZE];
+	const unsigned char *in = (const unsigned char *)binary, *p, *end;
+	std::vector<int> expected = text_numbers(text);
+	int length = 0, code, k, meeting_time, dominant = 0, entry, share, energy, turns, attempted, successful;
+	unsigned int packed;
+
+	// undo the COBS framing
+	while (*in != 0x00)
+	{
+		code = *in++;
+		for (k = 1; k < code; k++)
+		{
+			if (*in == 0x00 || length >= (int)sizeof(raw))
+			{
+				return false;
+			}
+			raw[length++] = *in++;
+		}
+		if (code < 0xff && *in != 0x00 && length < (int)sizeof(raw))
+		{
+			raw[length++] = 0x00;
+		}
+	}
+
+	p = raw;
+	end = raw + length;
+	if (expected.size() < 2 || (expected.size() - 2) % 8 != 0 || p == end || *p++ != BINARYSCHEMA ||
+		(meeting_time = decode_varint(&p, end)) != expected[0])
+	{
+		return false;
+	}
+	for (entry = 2; p < end; entry += 8)
+	{
+		if (end - p < 4 || entry + 8 > (int)expected.size())
+		{
+			return false;
+		}
+		packed = p[0] | p[1] << 8;
+		share = p[2];
+		energy = p[3] & 7;
+		turns = p[3] >> 3 & 7;
+		attempted = p[3] >> 6 & 1;
+		successful = p[3] >> 7;
+		p += 4;
+		if (turns == 7)
+		{
+			turns = decode_varint(&p, end);
+			attempted = decode_varint(&p, end);
+			successful = decode_varint(&p, end);
+		}
+		if ((packed & 0x8000) != 0)
+		{
+			dominant = packed >> 9 & 0x1f;
+		}
+
+		if ((int)(packed >> 9 & 0x1f) != expected[entry] || (int)(packed & 0x1ff) != expected[entry + 1] ||
+			((packed & 0x4000) != 0) != (expected[entry + 2] != 0) || turns != expected[entry + 3] ||
+			fabs((double)share * meeting_time / 255 - expected[entry + 4]) > meeting_time / 510.0 + 1 ||
+			fabs(energy * 100.0 / 7 - expected[entry + 5]) > 100.0 / 14 + 1 || attempted != expected[entry + 6] ||
+			successful != expected[entry + 7])
+		{
+			return false;
+		}
+	}
+	if (entry != (int)expected.size())
+	{
+		return false;
+	}
+
+	// the dominant talker is only flagged if they are still in the payload
+	for (entry = 2; entry < (int)expected.size() && expected[entry] != expected[1]; entry += 8)
+	{
+	}
+	return dominant == (entry < (int)expected.size() ? expected[1] : 0);
+}
+
+static int failed_checks = 0;
+
+// names a check that failed, so the exit code is not the only sign of which property broke
+static void report_check(const char *name, bool passed)
+{
+	if (!passed)
+	{
+		printf("FAILED: %s\n", name);
+		++failed_checks;
+	}
+}
+
+// both text builders have to agree byte for byte on every frame
+static bool check_payload_builders(const std::vector<meeting_snapshot> &snapshots)
+{
+	std::string payload;
+	char payload_text[MAXLINE];
+	unsigned long mismatches = 0;
+	size_t f;
+
+	for (f = 0; f < snapshots.size(); f++)
+	{
+		build_payload_string(payload, &snapshots[f].meeting_data, &snapshots[f].participant_data_array[0]);
+		build_payload_text(payload_text, sizeof(payload_text), &snapshots[f].meeting_data, &snapshots[f].participant_data_array[0]);
+		mismatches += payload != payload_text;
+	}
+	printf("payload builders differ on %lu of %zu frames\n", mismatches, snapshots.size());
+	return mismatches == 0;
+}
+
+// every frame's binary payload has to go out in one notification at the default MTU
+static bool check_binary_size(const std::vector<meeting_snapshot> &snapshots)
+{
+	char binary[MAXLINE];
+	unsigned long oversize = 0;
+	int length;
+	size_t f;
+
+	for (f = 0; f < snapshots.size(); f++)
+	{
+		length = build_payload_binary(binary, sizeof(binary), &snapshots[f].meeting_data, &snapshots[f].participant_data_array[0]);
+		oversize += length < 0 || length > BINARYMTUVALUE;
+	}
+	printf("binary payloads over one %d byte notification on %lu of %zu frames\n", BINARYMTUVALUE, oversize, snapshots.size());
+	return oversize == 0;
+}
+
+// a client decoding the binary form has to get back what the text says
+static bool check_binary_decode(const std::vector<meeting_snapshot> &snapshots)
+{
+	char binary[MAXLINE], payload_text[MAXLINE];
+	unsigned long mismatches = 0;
+	size_t f;
+
+	for (f = 0; f < snapshots.size(); f++)
+	{
+		build_payload_binary(binary, sizeof(binary), &snapshots[f].meeting_data, &snapshots[f].participant_data_array[0]);
+		build_payload_text(payload_text, sizeof(payload_text), &snapshots[f].meeting_data, &snapshots[f].participant_data_array[0]);
+		mismatches += !binary_matches_text(binary, payload_text);
+	}
+	printf("binary payloads decode differently from the text on %lu of %zu frames\n", mismatches, snapshots.size());
+	return mismatches == 0;
+}
+
+// fast_direction against libm all the way round the clock, plus the axes and signed zeros where the folding could go
+// wrong.  Every direction has to land in [0,360).  The same points, with y as the distance across the floor, take
+// fast_elevation from straight down to straight up
+static bool check_bearings()
+{
+	double worst = 0.0, error, expected, direction;
+	unsigned long out_of_range = 0;
+	const double edges[][2] = {{0.0, 1.0}, {1.0, 0.0}, {0.0, -1.0}, {-1.0, 0.0}, {-0.0, 1.0}, {-0.0, -1.0},
+							   {1.0, -0.0}, {-1.0, -0.0}, {1.0, 1.0}, {-1.0, -1.0}, {1e-300, -1.0}, {-1e-300, -1.0}};
+	int i;
+
+	for (i = 0; i < 3600000 + (int)(sizeof(edges) / sizeof(edges[0])); i++)
+	{
+		double x = i < 3600000 ? sin(i * M_PI / 1800000) : edges[i - 3600000][0];
+		double y = i < 3600000 ? cos(i * M_PI / 1800000) : edges[i - 3600000][1];
+
+		direction = fast_direction(x, y);
+		expected = 180 - (atan2(x, y) * DEGREES);
+		error = fabs(direction - expected);
+		error = error > 180.0 ? 360.0 - error : error;
+		worst = error > worst ? error : worst;
+		out_of_range += direction < 0.0 || direction >= 360.0;
+
+		error = fabs(fast_elevation(fabs(y), x) - atan2(x, fabs(y)) * DEGREES);
+		worst = error > worst ? error : worst;
+	}
+	printf("fast_direction and fast_elevation are out by at most %.6f degrees, %lu directions outside [0,360)\n", worst, out_of_range);
+	return worst <= BEARINGERROR && out_of_range == 0;
+}
+
+// the same meeting with every third frame lost on the way in, as an overloaded ingest would lose them.  The meeting
+// clock comes from the timeStamps, so the meeting has to come out just as long and talk time close to it
+static bool check_lost_frames(const std::vector<odas_frame> &odas_frames, meeting *meeting_data, participant_data *participant_data_array,
+							  odas_data *odas_data_array)
+{
+	int full_meeting_time, full_talk_time = 0, dropped_talk_time = 0, i;
+	size_t f;
+
+	initialise_meeting_data(meeting_data, participant_data_array, odas_data_array);
+	for (f = 0; f < odas_frames.size(); f++)
+	{
+		process_sound_data(meeting_data, participant_data_array, (odas_data *)odas_frames[f].source, odas_frames[f].time_stamp);
+	}
+	full_meeting_time = meeting_data->total_meeting_time;
+	for (i = 0; i < meeting_data->num_participants; i++)
+	{
+		full_talk_time += participant_data_array[i].participant_total_talk_time;
+	}
+	initialise_meeting_data(meeting_data, participant_data_array, odas_data_array);
+	for (f = 0; f < odas_frames.size(); f++)
+	{
+		if (f % 3 != 1)
+		{
+			process_sound_data(meeting_data, participant_data_array, (odas_data *)odas_frames[f].source, odas_frames[f].time_stamp);
+		}
+	}
+	for (i = 0; i < meeting_data->num_participants; i++)
+	{
+		dropped_talk_time += participant_data_array[i].participant_total_talk_time;
+	}
+	printf("with a third of frames lost: meeting %d of %d frames, talk %d of %d, %lu lost in %d gaps\n", meeting_data->total_meeting_time,
+		   full_meeting_time, dropped_talk_time, full_talk_time, meeting_data->lost_frames, meeting_data->frame_gaps);
+	return meeting_data->total_meeting_time == full_meeting_time && meeting_data->lost_frames == odas_frames.size() / 3 &&
+		   abs(dropped_talk_time - full_talk_time) * 20 <= full_talk_time;
+}
+
+// each pass journalled as a meeting of its own, the way meetpie -J records them.  The writer runs on this thread so
+// the time includes putting the blocks in the page cache.  Then a second writer opens the same journal and has to
+// carry the meeting numbers on, and every seek has to land where a walk from the start would
+static bool check_journal(const std::vector<meeting_snapshot> &snapshots, int iterations)
+{
+	static journal_writer journal;
+	journal_reader reader;
+	journal_cursor cursor;
+	journal_entry entry;
+	std::vector<journal_entry> entries;
+	char journal_name[] = "/tmp/meetpie_bench_XXXXXX";
+	unsigned long frames = snapshots.size() * iterations, journal_records, seek_mismatches = 0, seeks = 0, e, first_entry;
+	uint32_t meeting_number, meeting_time, last_time;
+	bool found;
+	int pass, i;
+	size_t f;
+
+	close(mkstemp(journal_name));
+	journal_open_writer(&journal, journal_name);
+	printf("\n");
+	start_bench();
+	for (pass = 0; pass < iterations; pass++)
+	{
+		for (f = 0; f < snapshots.size(); f++)
+		{
+			if (snapshots[f].meeting_data.num_participants > 0)
+			{
+				journal_record(&journal, &snapshots[f].meeting_data, &snapshots[f].participant_data_array[0]);
+				journal_write_queued(&journal);
+			}
+		}
+		journal_end_meeting(&journal);
+		journal_write_queued(&journal);
+	}
+	stop_bench("journal_record", frames, 0);
+	printf("journal: %lu frames in %lu blocks, %.1f bytes/frame on the card, %lu dropped, %lu failed\n", journal.records,
+		   journal.blocks_written.load(), (double)journal.file_blocks * JOURNALBLOCK / journal.records, journal.dropped.load(), journal.failed.load());
+	journal_records = journal.records;
+	journal_close_writer(&journal);
+
+	journal_open_writer(&journal, journal_name);
+	for (f = 0; f < snapshots.size(); f++)
+	{
+		journal_record(&journal, &snapshots[f].meeting_data, &snapshots[f].participant_data_array[0]);
+		journal_write_queued(&journal);
+	}
+	journal_end_meeting(&journal);
+	journal_write_queued(&journal);
+	journal_close_writer(&journal);
+
+	found = journal_open(&reader, journal_name);
+	cursor.block = 0;
+	cursor.offset = 0;
+	while (found && journal_next(&reader, &cursor, &entry))
+	{
+		entries.push_back(entry);
+	}
+	seek_mismatches += !found || journal_meetings(&reader) != (uint32_t)iterations + 1 || entries.size() != journal_records + snapshots.size();
+
+	// every meeting, at every time a record could have and past the end of it, and a meeting past the last
+	last_time = snapshots.back().meeting_data.total_meeting_time + 2;
+	for (meeting_number = 1, first_entry = 0; found && meeting_number <= (uint32_t)iterations + 2; meeting_number++)
+	{
+		for (meeting_time = 0, e = first_entry; meeting_time <= last_time; meeting_time++, seeks++)
+		{
+			while (e < entries.size() && !(entries[e].meeting > meeting_number ||
+										   (entries[e].meeting == meeting_number && entries[e].meeting_time >= meeting_time)))
+			{
+				++e;
+			}
+			if (journal_seek(&reader, &cursor, meeting_number, meeting_time))
+			{
+				seek_mismatches += e == entries.size() || !journal_next(&reader, &cursor, &entry) || entry.state != entries[e].state;
+			}
+			else
+			{
+				seek_mismatches += e != entries.size();
+			}
+		}
+		while (first_entry < entries.size() && entries[first_entry].meeting <= meeting_number)
+		{
+			++first_entry;
+		}
+	}
+	start_bench();
+	for (i = 0; found && i < 100000; i++)
+	{
+		e = (i * 7919UL) % entries.size();
+		journal_seek(&reader, &cursor, entries[e].meeting, entries[e].meeting_time);
+		bench_sink += cursor.offset;
+	}
+	stop_bench("journal_seek", 100000, 0);
+	printf("journal seeks differ from a walk on %lu of %lu\n", seek_mismatches, seeks);
+	if (found)
+	{
+		journal_close(&reader);
+	}
+	unlink(journal_name);
+	return seek_mismatches == 0;
+}
+
+//
+// Entry point
+//
+
+int main(int argc, char **ppArgv)
+{
+	std::string corpus_name = "bench/odas_sst_frames.txt";
+	int iterations = 20;
+	int i, pass;
+	size_t f;
+
+	for (i = 1; i < argc; ++i)
+	{
+		std::string arg = ppArgv[i];
+		if (arg == "-n" && i + 1 < argc)
+		{
+			iterations = atoi(ppArgv[++i]);
+		}
+		else if (arg[0] != '-')
+		{
+			corpus_name = arg;
+		}
+		else
+		{
+			printf("Usage: meetpie_bench [-n iterations] [corpus]\n");
+			return -1;
+		}
+	}
+
+	// load the corpus - each line is one datagram as odas would send it
+	std::vector<std::string> corpus;
+	std::ifstream corpus_file(corpus_name);
+	std::string line;
+	unsigned long corpus_bytes = 0;
+
+	while (std::getline(corpus_file, line))
+	{
+		if (!line.empty())
+		{
+			corpus.push_back(line);
+			corpus_bytes += line.size();
+		}
+	}
+	if (corpus.empty() || iterations < 1)
+	{
+		printf("no frames in corpus '%s'\n", corpus_name.c_str());
+		return -1;
+	}
+
+	unsigned long frames = corpus.size() * iterations;
+	printf("%zu frames from %s, %d passes\n\n", corpus.size(), corpus_name.c_str(), iterations);
+
+	// set everything up front so none of it is counted against the benchmarks
+	odas_data odas_data_array[MAXCHANNELS];
+	unsigned long time_stamp = 0;
+	int num_sources = 0;
+	std::vector<odas_frame> odas_frames(corpus.size());
+	std::vector<json_object *> json_items;
+	std::vector<int> json_item_index;
+	std::vector<meeting_snapshot> snapshots(corpus.size());
+	meeting meeting_data;
+	participant_data *participant_data_array;
+	std::string payload;
+	json_object *jobj, *jobj_array;
+	std::vector<json_object *> json_frames;
+
+	memset(odas_data_array, 0, sizeof(odas_data_array));
+	for (f = 0; f < corpus.size(); f++)
+	{
+		odas_frames[f].num_sources = sst_parse(&corpus[f][0], odas_data_array, MAXCHANNELS, &odas_frames[f].time_stamp);
+		memcpy(odas_frames[f].source, odas_data_array, sizeof(odas_frames[f].source));
+		num_sources = odas_frames[f].num_sources > num_sources ? odas_frames[f].num_sources : num_sources;
+
+		jobj = json_tokener_parse(corpus[f].c_str());
+		json_frames.push_back(jobj);
+		if (jobj != NULL && json_object_object_get_ex(jobj, "src", &jobj_array))
+		{
+			for (i = 0; i < (int)json_object_array_length(jobj_array) && i < MAXCHANNELS; i++)
+			{
+				json_items.push_back(json_object_array_get_idx(jobj_array, i));
+				json_item_index.push_back(i);
+			}
+		}
+	}
+
+	allocate_meeting_data(&meeting_data, &participant_data_array, MAXPART);
+	meeting_data.num_channels = num_sources < MAXCHANNELS ? num_sources : MAXCHANNELS;
+	initialise_meeting_data(&meeting_data, participant_data_array, odas_data_array);
+	for (f = 0; f < corpus.size(); f++)
+	{
+		process_sound_data(&meeting_data, participant_data_array, odas_frames[f].source, odas_frames[f].time_stamp);
+		snapshots[f].meeting_data = meeting_data;
+		snapshots[f].participant_data_array.assign(participant_data_array, participant_data_array + MAXPART);
+	}
+	payload.reserve(MAXLINE);
+
+	// json-c parse of a whole datagram
+	start_bench();
+	for (pass = 0; pass < iterations; pass++)
+	{
+		for (f = 0; f < corpus.size(); f++)
+		{
+			json_parse(&corpus[f][0], odas_data_array, MAXCHANNELS, &time_stamp);
+		}
+	}
+	stop_bench("json_parse", frames, corpus_bytes * iterations);
+	bench_sink += odas_data_array[0].x != 0.0;
+
+	// json-c extraction of one src item from an already built tree
+	start_bench();
+	for (pass = 0; pass < iterations; pass++)
+	{
+		for (f = 0; f < json_items.size(); f++)
+		{
+			json_parse_item(json_items[f], odas_data_array, json_item_index[f]);
+		}
+	}
+	stop_bench("json_parse_item", json_items.size() * iterations, 0);
+	bench_sink += odas_data_array[0].x != 0.0;
+
+	// allocation free parse of a whole datagram
+	start_bench();
+	for (pass = 0; pass < iterations; pass++)
+	{
+		for (f = 0; f < corpus.size(); f++)
+		{
+			sst_parse(&corpus[f][0], odas_data_array, MAXCHANNELS, &time_stamp);
+		}
+	}
+	stop_bench("sst_parse", frames, corpus_bytes * iterations);
+	bench_sink += odas_data_array[0].x != 0.0;
+
+	// meeting analytics - each pass is a fresh meeting over the whole corpus
+	start_bench();
+	for (pass = 0; pass < iterations; pass++)
+	{
+		initialise_meeting_data(&meeting_data, participant_data_array, odas_data_array);
+		for (f = 0; f < corpus.size(); f++)
+		{
+			process_sound_data(&meeting_data, participant_data_array, odas_frames[f].source, odas_frames[f].time_stamp);
+		}
+	}
+	stop_bench("process_sound_data", frames, 0);
+	bench_sink += meeting_data.num_participants;
+
+	// each frame's source directions and elevations, first with atan2 per channel, then in one pass
+	double direction_x[MAXCHANNELS], direction_y[MAXCHANNELS], direction_z[MAXCHANNELS], directions[MAXCHANNELS], elevations[MAXCHANNELS];
+	double source_length, total = 0.0;
+	start_bench();
+	for (pass = 0; pass < iterations; pass++)
+	{
+		for (f = 0; f < corpus.size(); f++)
+		{
+			for (i = 0; i < meeting_data.num_channels; i++)
+			{
+				source_length = sqrt(odas_frames[f].source[i].x * odas_frames[f].source[i].x + odas_frames[f].source[i].y * odas_frames[f].source[i].y +
+									 odas_frames[f].source[i].z * odas_frames[f].source[i].z);
+				source_length = source_length > 0.0 ? 1.0 / source_length : 0.0;
+				direction_x[i] = odas_frames[f].source[i].x * source_length;
+				direction_y[i] = odas_frames[f].source[i].y * source_length;
+				direction_z[i] = odas_frames[f].source[i].z * source_length;
+				directions[i] = 180 - (atan2(direction_x[i], direction_y[i]) * DEGREES);
+				elevations[i] = atan2(direction_z[i], sqrt(direction_x[i] * direction_x[i] + direction_y[i] * direction_y[i])) * DEGREES;
+			}
+			total += directions[0];
+		}
+	}
+	stop_bench("atan2 directions", frames, 0);
+	bench_sink += total;
+
+	total = 0.0;
+	start_bench();
+	for (pass = 0; pass < iterations; pass++)
+	{
+		for (f = 0; f < corpus.size(); f++)
+		{
+			source_directions(odas_frames[f].source, meeting_data.num_channels, direction_x, direction_y, direction_z, directions, elevations);
+			total += directions[0];
+		}
+	}
+	stop_bench("source_directions", frames, 0);
+	bench_sink += total;
+
+	// finding who each of a frame's sources belongs to, against everyone the meeting ended up with.  Directions are
+	// worked out up front so only the gating and likelihoods are timed
+	std::vector<double> frame_directions(corpus.size() * MAXCHANNELS), frame_elevations(corpus.size() * MAXCHANNELS);
+	for (f = 0; f < corpus.size(); f++)
+	{
+		source_directions(odas_frames[f].source, meeting_data.num_channels, direction_x, direction_y, direction_z,
+						  &frame_directions[f * MAXCHANNELS], &frame_elevations[f * MAXCHANNELS]);
+	}
+	start_bench();
+	for (pass = 0; pass < iterations; pass++)
+	{
+		for (f = 0; f < corpus.size(); f++)
+		{
+			for (i = 0; i < meeting_data.num_channels; i++)
+			{
+				if (odas_frames[f].source[i].x != 0.0 && odas_frames[f].source[i].y != 0.0)
+				{
+					bench_sink += cluster_assign(&meeting_data, participant_data_array, frame_directions[f * MAXCHANNELS + i],
+												 frame_elevations[f * MAXCHANNELS + i]);
+				}
+			}
+		}
+	}
+	stop_bench("cluster_assign", frames, 0);
+
+	// building the text/string payload
+	start_bench();
+	for (pass = 0; pass < iterations; pass++)
+	{
+		for (f = 0; f < corpus.size(); f++)
+		{
+			build_payload_string(payload, &snapshots[f].meeting_data, &snapshots[f].participant_data_array[0]);
+			bench_sink += payload.size();
+		}
+	}
+	stop_bench("build_payload_string", frames, 0);
+
+	// the allocation free builder meetpie serves from
+	char payload_text[MAXLINE];
+	start_bench();
+	for (pass = 0; pass < iterations; pass++)
+	{
+		for (f = 0; f < corpus.size(); f++)
+		{
+			bench_sink += build_payload_text(payload_text, sizeof(payload_text), &snapshots[f].meeting_data, &snapshots[f].participant_data_array[0]);
+		}
+	}
+	stop_bench("build_payload_text", frames, 0);
+
+	// delta payloads against the previous frame, as meetpie -u sends them
+	payload_delta_state delta_state;
+	unsigned long text_bytes = 0, delta_bytes = 0;
+	int length;
+	payload_delta_init(&delta_state, MAXPART);
+	start_bench();
+	for (pass = 0; pass < iterations; pass++)
+	{
+		for (f = 0; f < corpus.size(); f++)
+		{
+			length = build_payload_delta(payload_text, sizeof(payload_text), &delta_state, &snapshots[f].meeting_data, &snapshots[f].participant_data_array[0]);
+			delta_bytes += length > 0 ? length : 0;
+		}
+	}
+	stop_bench("build_payload_delta", frames, 0);
+
+	// compact binary payloads, as served after a client writes "binary"
+	unsigned long binary_bytes = 0, binary_largest = 0;
+	start_bench();
+	for (pass = 0; pass < iterations; pass++)
+	{
+		for (f = 0; f < corpus.size(); f++)
+		{
+			bench_sink += build_payload_binary(payload_text, sizeof(payload_text), &snapshots[f].meeting_data, &snapshots[f].participant_data_array[0]);
+		}
+	}
+	stop_bench("build_payload_binary", frames, 0);
+
+	for (f = 0; f < corpus.size(); f++)
+	{
+		length = build_payload_binary(payload_text, sizeof(payload_text), &snapshots[f].meeting_data, &snapshots[f].participant_data_array[0]);
+		binary_bytes += length;
+		binary_largest = (unsigned long)length > binary_largest ? length : binary_largest;
+		text_bytes += build_payload_text(payload_text, sizeof(payload_text), &snapshots[f].meeting_data, &snapshots[f].participant_data_array[0]);
+	}
+	printf("\npayload bytes/frame: text %.1f, delta %.1f, binary %.1f (largest %lu)\n", (double)text_bytes / corpus.size(),
+		   (double)delta_bytes / frames, (double)binary_bytes / corpus.size(), binary_largest);
+
+	report_check("payload builders agree", check_payload_builders(snapshots));
+	report_check("binary payloads fit one notification", check_binary_size(snapshots));
+	report_check("binary payloads decode to the text", check_binary_decode(snapshots));
+	report_check("bearings", check_bearings());
+	report_check("meeting clock with lost frames", check_lost_frames(odas_frames, &meeting_data, participant_data_array, odas_data_array));
+	report_check("journal seeks", check_journal(snapshots, iterations));
+
+	for (f = 0; f < json_frames.size(); f++)
+	{
+		json_object_put(json_frames[f]);
+	}
+	payload_delta_free(&delta_state);
+	free_meeting_data(&meeting_data, participant_data_array);
+
+	if (failed_checks > 0)
+	{
+		printf("\n%d check%s failed\n", failed_checks, failed_checks == 1 ? "" : "s");
+	}
+	return failed_checks == 0 ? 0 : 1;
+}
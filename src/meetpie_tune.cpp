@@ -0,0 +1,449 @@
+//
+//  meetpie_tune.cpp
+//
+//  searches for the thresholds that best reproduce how people labelled their recordings.  Every
+//  recording in a directory with a <recording>.label beside it is parsed once, up front, into frames
+//  that every thread reads and none writes.  Each candidate set of thresholds is then run over all of
+//  them through process_sound_data on meeting state of its own, one candidate per thread at a time.
+//  The best few are reported and the best is written out as a config file meetpie loads at startup.
+//  It links none of the bluetooth code so it runs anywhere json-c is installed.
+//
+//  usage: meetpie_tune [-t threads] [-j] [-p max participants] [-s sources] [-r random candidates]
+//                      [-o config file] directory
+//
+//  a label file has a line for each meeting in the recording, in order: how many people there were
+//  and then, if it is known, how long each of them talked in frames, in any order
+//
+//      # stand up, then the design review
+//      4 1200 950 400 80
+//      2
+//
+//  without -r every combination in the grid below is tried.  The defaults are always tried first and
+//  only lose to a candidate that does strictly better
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "../include/meetpie.h"
+#include "../include/json_parsing.h"
+#include "../include/recording.h"
+#include "../include/tuning.h"
+
+static const double grid_min_energy[] = {0.0, 0.05, 0.1, 0.2, 0.3};
+static const double grid_angle_spread[] = {6, 8, 10, 12, 15, 20, 25};
+static const int grid_min_talk_time[] = {1, 2, 3, 5, 8};
+static const int grid_max_silence[] = {250, 500, 750, 1000, 1500};
+static const size_t grid_sizes[] = {sizeof(grid_min_energy) / sizeof(grid_min_energy[0]), sizeof(grid_angle_spread) / sizeof(grid_angle_spread[0]),
+									 sizeof(grid_min_talk_time) / sizeof(grid_min_talk_time[0]), sizeof(grid_max_silence) / sizeof(grid_max_silence[0])};
+
+// what a meeting came to, or was labelled as - the talk times are sorted longest first so nobody has to say which
+// participant number was who
+typedef struct meeting_outcome{
+    int participants;
+    std::vector<int> talk;
+ } meeting_outcome;
+
+// a recording parsed once for everyone.  Each frame keeps channels sources, which is as many as any frame had
+typedef struct tune_recording{
+    std::string name;
+    int channels;
+    std::vector<odas_data> sources;
+    std::vector<unsigned long> time_stamps;
+    std::vector<unsigned char> num_sources;     // as parsed, for working out num_channels the way meetpie does
+    std::vector<meeting_outcome> labels;
+ } tune_recording;
+
+typedef struct tune_candidate{
+    meeting_tuning tuning;
+    double cost;
+    int meetings;
+ } tune_candidate;
+
+// the recordings are only read once the threads start, and each candidate is only written by the thread that took it
+typedef struct tune_state{
+    std::vector<tune_recording> recordings;
+    std::vector<tune_candidate> candidates;
+    std::atomic<size_t> next;
+    int num_sources;
+    int max_participants;
+ } tune_state;
+
+static bool cheapest(const tune_candidate &a, const tune_candidate &b)
+{
+	return a.cost < b.cost;
+}
+
+// reads a label file.  Returns false if it cannot be read or a line is not a count followed by talk times
+static bool load_labels(const std::string &filename, std::vector<meeting_outcome> *labels)
+{
+	std::ifstream file(filename);
+	std::string line;
+	meeting_outcome outcome;
+	int talk;
+
+	if (!file.is_open())
+	{
+		return false;
+	}
+	while (std::getline(file, line))
+	{
+		line = line.substr(0, line.find('#'));
+		if (line.find_first_not_of(" \t\r") == std::string::npos)
+		{
+			continue;
+		}
+
+		std::istringstream fields(line);
+		if (!(fields >> outcome.participants))
+		{
+			return false;
+		}
+		outcome.talk.clear();
+		while (fields >> talk)
+		{
+			outcome.talk.push_back(talk);
+		}
+		if (!fields.eof() || outcome.participants < 0 || (!outcome.talk.empty() && (int)outcome.talk.size() != outcome.participants))
+		{
+			return false;
+		}
+		std::sort(outcome.talk.rbegin(), outcome.talk.rend());
+		labels->push_back(outcome);
+	}
+	return true;
+}
+
+// parses a recording the way the ingest thread would have, keeping every frame
+static bool load_recording(tune_recording *recording, odas_parser parse, int num_sources)
+{
+	recording_reader reader;
+	odas_data parse_target[MAXCHANNELS];
+	char input_buffer[MAXLINE];
+	const char *datagram;
+	int length, frame_sources, i;
+	uint32_t gap_us;
+	unsigned long time_stamp = 0;
+	std::vector<odas_data> all_sources;
+
+	if (!recording_open(&reader, recording->name.c_str()))
+	{
+		return false;
+	}
+	memset(parse_target, 0, sizeof(parse_target));
+	recording->channels = num_sources;
+	while (recording_next(&reader, &datagram, &length, &gap_us))
+	{
+		length = length < MAXLINE ? length : MAXLINE - 1;
+		memcpy(input_buffer, datagram, length);
+		input_buffer[length] = 0x00;
+		frame_sources = parse(input_buffer, parse_target, MAXCHANNELS, &time_stamp);
+		frame_sources = frame_sources < MAXCHANNELS ? frame_sources : MAXCHANNELS;
+
+		all_sources.insert(all_sources.end(), parse_target, parse_target + MAXCHANNELS);
+		recording->time_stamps.push_back(time_stamp);
+		recording->num_sources.push_back(frame_sources);
+		recording->channels = frame_sources > recording->channels ? frame_sources : recording->channels;
+	}
+	recording_close(&reader);
+
+	// only keep the channels anything will look at
+	for (i = 0; i < (int)recording->time_stamps.size(); i++)
+	{
+		recording->sources.insert(recording->sources.end(), all_sources.begin() + i * MAXCHANNELS,
+								  all_sources.begin() + i * MAXCHANNELS + recording->channels);
+	}
+	return true;
+}
+
+// who was in a meeting and for how long
+static meeting_outcome outcome_of(const meeting *meeting_data, const participant_data *participant_data_array)
+{
+	meeting_outcome outcome;
+	int i;
+
+	outcome.participants = 0;
+	for (i = 0; i < meeting_data->num_participants; i++)
+	{
+		if (participant_data_array[i].participant_frames != 0)
+		{
+			++outcome.participants;
+			outcome.talk.push_back(participant_data_array[i].participant_total_talk_time);
+		}
+	}
+	std::sort(outcome.talk.rbegin(), outcome.talk.rend());
+	return outcome;
+}
+
+// how far what was found is from the labels.  A meeting costs one for each person too many or too few, plus the share
+// of its labelled talk time that went to the wrong person.  A meeting found that was not labelled, or labelled and not
+// found, costs one more than everyone in it
+static double cost_of(const std::vector<meeting_outcome> &found, const std::vector<meeting_outcome> &labels)
+{
+	double cost = 0.0, labelled_talk, wrong_talk;
+	size_t m, i;
+
+	for (m = 0; m < found.size() || m < labels.size(); m++)
+	{
+		if (m >= labels.size())
+		{
+			cost += 1 + found[m].participants;
+		}
+		else if (m >= found.size())
+		{
+			cost += 1 + labels[m].participants;
+		}
+		else
+		{
+			cost += abs(found[m].participants - labels[m].participants);
+			if (!labels[m].talk.empty())
+			{
+				labelled_talk = wrong_talk = 0.0;
+				for (i = 0; i < found[m].talk.size() || i < labels[m].talk.size(); i++)
+				{
+					labelled_talk += i < labels[m].talk.size() ? labels[m].talk[i] : 0;
+					wrong_talk += abs((i < found[m].talk.size() ? found[m].talk[i] : 0) - (i < labels[m].talk.size() ? labels[m].talk[i] : 0));
+				}
+				cost += labelled_talk > 0.0 ? wrong_talk / labelled_talk : 0.0;
+			}
+		}
+	}
+	return cost;
+}
+
+// every recording through one candidate's thresholds, exactly as a live meetpie would have run with them
+static void run_candidate(tune_state *state, tune_candidate *candidate, meeting *meeting_data, participant_data *participant_data_array,
+						  odas_data *odas_data_array)
+{
+	std::vector<meeting_outcome> found;
+	size_t r, f;
+
+	candidate->cost = 0.0;
+	candidate->meetings = 0;
+	for (r = 0; r < state->recordings.size(); r++)
+	{
+		const tune_recording *recording = &state->recordings[r];
+
+		found.clear();
+		initialise_meeting_data(meeting_data, participant_data_array, odas_data_array);
+		meeting_data->num_channels = state->num_sources;
+		meeting_data->tuning = candidate->tuning;
+		for (f = 0; f < recording->time_stamps.size(); f++)
+		{
+			if (state->num_sources == 0 && recording->num_sources[f] > meeting_data->num_channels)
+			{
+				meeting_data->num_channels = recording->num_sources[f];
+			}
+
+			// process_sound_data only reads the sources, so the shared copy is handed over as it is
+			process_sound_data(meeting_data, participant_data_array, (odas_data *)&recording->sources[f * recording->channels],
+							   recording->time_stamps[f]);
+			if (meeting_is_over(meeting_data))
+			{
+				found.push_back(outcome_of(meeting_data, participant_data_array));
+				initialise_meeting_data(meeting_data, participant_data_array, odas_data_array);
+			}
+		}
+		if (meeting_data->num_participants > 0)
+		{
+			found.push_back(outcome_of(meeting_data, participant_data_array));
+		}
+
+		candidate->cost += cost_of(found, recording->labels);
+		candidate->meetings += found.size();
+	}
+}
+
+// a worker thread - takes the next candidate nobody has started until there are none left
+static void run_worker(tune_state *state)
+{
+	meeting meeting_data;
+	participant_data *participant_data_array;
+	odas_data odas_data_array[MAXCHANNELS];
+	size_t c;
+
+	if (!allocate_meeting_data(&meeting_data, &participant_data_array, state->max_participants))
+	{
+		return;
+	}
+	while ((c = state->next.fetch_add(1, std::memory_order_relaxed)) < state->candidates.size())
+	{
+		run_candidate(state, &state->candidates[c], &meeting_data, participant_data_array, odas_data_array);
+	}
+	free_meeting_data(&meeting_data, participant_data_array);
+}
+
+//
+// Entry point
+//
+
+int main(int argc, char **ppArgv)
+{
+	tune_state state;
+	tune_candidate candidate;
+	std::string directory, config_file = TUNINGFILE;
+	odas_parser parse = sst_parse;
+	int threads = std::thread::hardware_concurrency();
+	int random_candidates = 0, labelled_meetings = 0, i;
+	unsigned int seed = 1;
+	unsigned long frames = 0;
+	size_t c, r;
+	DIR *dir;
+	struct dirent *entry;
+	struct stat file_stat;
+	char comment[MAXLINE];
+
+	state.num_sources = 0;
+	state.max_participants = MAXPART;
+
+	for (i = 1; i < argc; ++i)
+	{
+		std::string arg = ppArgv[i];
+		if (arg == "-t" && i + 1 < argc)
+		{
+			threads = atoi(ppArgv[++i]);
+		}
+		else if (arg == "-j")
+		{
+			parse = json_parse;
+		}
+		else if (arg == "-s" && i + 1 < argc)
+		{
+			state.num_sources = atoi(ppArgv[++i]);
+		}
+		else if (arg == "-p" && i + 1 < argc)
+		{
+			state.max_participants = atoi(ppArgv[++i]);
+		}
+		else if (arg == "-r" && i + 1 < argc)
+		{
+			random_candidates = atoi(ppArgv[++i]);
+		}
+		else if (arg == "-o" && i + 1 < argc)
+		{
+			config_file = ppArgv[++i];
+		}
+		else if (arg[0] != '-' && directory.empty())
+		{
+			directory = arg;
+		}
+		else
+		{
+			directory.clear();
+			break;
+		}
+	}
+	if (directory.empty() || threads < 1 || random_candidates < 0 || state.num_sources < 0 || state.num_sources > MAXCHANNELS ||
+		state.max_participants < 1 || state.max_participants > MAXPOOL)
+	{
+		fprintf(stderr, "Usage: meetpie_tune [-t threads] [-j] [-p max participants] [-s sources] [-r random candidates] [-o config file] directory\n");
+		return -1;
+	}
+
+	// every recording with a label beside it.  Recordings are taken in name order so a run is repeatable
+	if ((dir = opendir(directory.c_str())) == NULL)
+	{
+		fprintf(stderr, "unable to open %s\n", directory.c_str());
+		return -1;
+	}
+	std::vector<std::string> names;
+	while ((entry = readdir(dir)) != NULL)
+	{
+		std::string name = directory + "/" + entry->d_name;
+		size_t suffix = strlen(LABELSUFFIX);
+		if (name.size() > suffix && name.compare(name.size() - suffix, suffix, LABELSUFFIX) == 0 &&
+			!recording_sidecar(name.substr(0, name.size() - suffix).c_str()) && stat(name.c_str(), &file_stat) == 0 && S_ISREG(file_stat.st_mode))
+		{
+			names.push_back(name.substr(0, name.size() - suffix));
+		}
+	}
+	closedir(dir);
+	std::sort(names.begin(), names.end());
+
+	state.recordings.resize(names.size());
+	for (r = 0; r < names.size(); r++)
+	{
+		state.recordings[r].name = names[r];
+		if (!load_labels(names[r] + LABELSUFFIX, &state.recordings[r].labels))
+		{
+			fprintf(stderr, "%s%s is not a label file\n", names[r].c_str(), LABELSUFFIX);
+			return -1;
+		}
+		if (!load_recording(&state.recordings[r], parse, state.num_sources))
+		{
+			fprintf(stderr, "%s is not a recording\n", names[r].c_str());
+			return -1;
+		}
+		frames += state.recordings[r].time_stamps.size();
+		labelled_meetings += state.recordings[r].labels.size();
+	}
+	if (state.recordings.empty())
+	{
+		fprintf(stderr, "no labelled recordings in %s\n", directory.c_str());
+		return -1;
+	}
+
+	// the defaults first, so a tie leaves them as they are
+	default_tuning(&candidate.tuning);
+	state.candidates.push_back(candidate);
+	for (c = 0; random_candidates == 0 && c < grid_sizes[0] * grid_sizes[1] * grid_sizes[2] * grid_sizes[3]; c++)
+	{
+		candidate.tuning.min_energy = grid_min_energy[c / (grid_sizes[1] * grid_sizes[2] * grid_sizes[3])];
+		candidate.tuning.angle_spread = grid_angle_spread[c / (grid_sizes[2] * grid_sizes[3]) % grid_sizes[1]];
+		candidate.tuning.min_talk_time = grid_min_talk_time[c / grid_sizes[3] % grid_sizes[2]];
+		candidate.tuning.max_silence = grid_max_silence[c % grid_sizes[3]];
+		state.candidates.push_back(candidate);
+	}
+	for (i = 0; i < random_candidates; i++)
+	{
+		candidate.tuning.min_energy = 0.5 * rand_r(&seed) / RAND_MAX;
+		candidate.tuning.angle_spread = 5 + 25.0 * rand_r(&seed) / RAND_MAX;
+		candidate.tuning.min_talk_time = 1 + rand_r(&seed) % 10;
+		candidate.tuning.max_silence = 100 + rand_r(&seed) % 1901;
+		state.candidates.push_back(candidate);
+	}
+
+	threads = (size_t)threads < state.candidates.size() ? threads : state.candidates.size();
+	state.next.store(0);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::vector<std::thread> pool;
+	for (i = 0; i < threads; i++)
+	{
+		pool.push_back(std::thread(run_worker, &state));
+	}
+	for (i = 0; i < threads; i++)
+	{
+		pool[i].join();
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	tune_candidate defaults = state.candidates[0];
+	std::stable_sort(state.candidates.begin(), state.candidates.end(), cheapest);
+	printf("%zu candidates over %zu recordings (%lu frames, %d labelled meetings) in %.1f s on %d threads - %.0f frames/s\n\n",
+		   state.candidates.size(), state.recordings.size(), frames, labelled_meetings, seconds, threads, frames * state.candidates.size() / seconds);
+	printf("%10s %10s %12s %13s %11s %8s\n", "cost", "meetings", "min_energy", "angle_spread", "min_talk", "silence");
+	for (c = 0; c < state.candidates.size() && c < 10; c++)
+	{
+		printf("%10.3f %10d %12g %13g %11d %8d\n", state.candidates[c].cost, state.candidates[c].meetings, state.candidates[c].tuning.min_energy,
+			   state.candidates[c].tuning.angle_spread, state.candidates[c].tuning.min_talk_time, state.candidates[c].tuning.max_silence);
+	}
+	printf("%10.3f %10d %12s\n\n", defaults.cost, defaults.meetings, "(defaults)");
+
+	snprintf(comment, sizeof(comment), "meetpie_tune: cost %.3f over %zu labelled recordings, against %.3f for the defaults",
+			 state.candidates[0].cost, state.recordings.size(), defaults.cost);
+	if (!tuning_save(&state.candidates[0].tuning, config_file.c_str(), comment))
+	{
+		fprintf(stderr, "unable to write %s\n", config_file.c_str());
+		return -1;
+	}
+	printf("best thresholds written to %s\n", config_file.c_str());
+	return 0;
+}
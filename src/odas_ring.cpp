@@ -0,0 +1,62 @@
+//
+//  odas_ring.cpp
+//
+//  lock-free spsc ring between the ingest and analytics threads.  head and tail
+//  are free running counters, so occupancy is simply head - tail
+//
+
+#include "../include/odas_ring.h"
+
+
+void odas_ring_init(odas_ring *ring)
+{
+	ring->head.store(0);
+	ring->tail.store(0);
+	ring->pushed.store(0);
+	ring->overflows.store(0);
+	ring->high_water.store(0);
+}
+
+// producer side - if the consumer has fallen a whole ring behind the new frame is dropped and counted
+bool odas_ring_push(odas_ring *ring, const odas_frame *frame)
+{
+	unsigned int head = ring->head.load(std::memory_order_relaxed);
+	unsigned int occupancy = head - ring->tail.load(std::memory_order_acquire);
+
+	if (occupancy >= RINGSIZE)
+	{
+		ring->overflows.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	ring->frame[head & (RINGSIZE - 1)] = *frame;
+	ring->head.store(head + 1, std::memory_order_release);
+
+	ring->pushed.fetch_add(1, std::memory_order_relaxed);
+	if (occupancy + 1 > ring->high_water.load(std::memory_order_relaxed))
+	{
+		ring->high_water.store(occupancy + 1, std::memory_order_relaxed);
+	}
+	return true;
+}
+
+// consumer side - copies the oldest frame out and frees its slot
+bool odas_ring_pop(odas_ring *ring, odas_frame *frame)
+{
+	unsigned int tail = ring->tail.load(std::memory_order_relaxed);
+
+	if (tail == ring->head.load(std::memory_order_acquire))
+	{
+		return false;
+	}
+
+	*frame = ring->frame[tail & (RINGSIZE - 1)];
+	ring->tail.store(tail + 1, std::memory_order_release);
+	return true;
+}
+
+// safe to call from either side (or a third thread) - the answer is only a snapshot
+unsigned int odas_ring_occupancy(odas_ring *ring)
+{
+	return ring->head.load(std::memory_order_acquire) - ring->tail.load(std::memory_order_acquire);
+}
@@ -0,0 +1,439 @@
+//
+//  payload.cpp
+//
+//  the json text served on "text/string" -
+//      {"tMT": <meeting time>, "dT": <dominant talker>,
+//       "m": [[id,angle,talking,turns,talk time,energy,interrupts attempted,interrupts successful],...]}
+//  with one entry for every live participant.  Ids are participant numbers (slot + 1), and a number freed by someone
+//  who has gone can be given to someone new later on.  The dominant talker is a participant number, 0 when nobody has
+//  spoken during the talker window, and energy is their windowed average activity in percent
+//
+//  build_payload_text is what meetpie serves.  It writes into a caller supplied buffer and never allocates.
+//  build_payload_string is the original std::string version, kept as the reference the bench checks it against
+//
+//  build_payload_delta is the delta mode.  Every payload carries a version "v" that goes up by one each time.
+//  A keyframe is the full text above plus "v"; in between, "d" only lists the entries of participants who are
+//  new or have changed since the last payload.  When someone goes the next payload is a keyframe
+//
+//  build_payload_binary is the compact form, sized so a meeting of four fits one 20 byte notification at the
+//  default MTU.  Before framing it is
+//      [schema version] varint(tMT)
+//  followed, for each live participant, by four bytes
+//      u16 little endian: angle in bits 0-8, id in bits 9-13, talking in bit 14, dominant talker in bit 15
+//      [talk time as a share of tMT, 0-255]
+//      [energy in eighths in bits 0-2, turns in bits 3-5, interrupts attempted in bit 6, successful in bit 7]
+//  and, when turns is 7, varint(turns) varint(interrupts attempted) varint(interrupts successful) - the counts
+//  go out that way whenever turns is over 6 or either interrupt count over 1.  The participant count is however
+//  many entries there are.  Varints are 7 bits per byte, least significant first.  The server hands text/string
+//  out as a C string, so the whole thing is COBS framed - it never contains a zero byte and ends with the
+//  terminating null
+//
+//  build_payload_raw is the same state at full precision, for the journal -
+//      [RAWSCHEMA] [participant count] [dominant talker] varint(tMT)
+//  then for each live participant
+//      [id]   u16 little endian: angle in bits 0-8, talking in bit 9   varint(turns)   varint(talk time)   [energy]
+//      varint(interrupts attempted)   varint(interrupts successful)
+//
+
+#include "../include/payload.h"
+
+
+void build_payload_string(std::string &payload, const meeting *meeting_data, const participant_data *participant_data_array)
+{
+	int i;
+	bool first = true;
+
+	payload = "{\"tMT\": ";
+	payload += std::to_string(meeting_data->total_meeting_time);
+	payload += ", \"dT\": ";
+	payload += std::to_string(meeting_data->dominant_talker + 1);
+	payload += ",\n\"m\": [\n";
+
+	for (i = 0; i < meeting_data->num_participants; i++)
+	{
+		if (participant_data_array[i].participant_frames == 0)
+		{
+			continue;
+		}
+
+		payload += first ? "[" : ",[";
+		first = false;
+		payload += std::to_string(i + 1);
+		payload += ",";
+		payload += std::to_string(participant_data_array[i].participant_angle);
+		payload += ",";
+		payload += std::to_string(participant_data_array[i].participant_is_talking);
+		payload += ",";
+		payload += std::to_string(participant_data_array[i].participant_num_turns);
+		payload += ",";
+		payload += std::to_string(participant_data_array[i].participant_total_talk_time);
+		payload += ",";
+		payload += std::to_string(participant_data_array[i].participant_energy);
+		payload += ",";
+		payload += std::to_string(participant_data_array[i].participant_interrupts_attempted);
+		payload += ",";
+		payload += std::to_string(participant_data_array[i].participant_interrupts_successful);
+		payload += "]";
+	}
+
+	payload += "]}\n";
+}
+
+
+// to_chars style integer formatting, two digits at a time.  Writes nothing and returns NULL if the
+// number will not fit before end
+static char * format_int(char *p, char *end, int value)
+{
+	static const char digit_pairs[] =
+		"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+		"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+		"8081828384858687888990919293949596979899";
+	char digits[12];
+	char *d = digits + sizeof(digits);
+	unsigned int magnitude = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+
+	while (magnitude >= 100)
+	{
+		d -= 2;
+		memcpy(d, &digit_pairs[(magnitude % 100) * 2], 2);
+		magnitude /= 100;
+	}
+	if (magnitude >= 10)
+	{
+		d -= 2;
+		memcpy(d, &digit_pairs[magnitude * 2], 2);
+	}
+	else
+	{
+		*--d = '0' + magnitude;
+	}
+	if (value < 0)
+	{
+		*--d = '-';
+	}
+
+	if (p == NULL || end - p < digits + sizeof(digits) - d)
+	{
+		return NULL;
+	}
+	memcpy(p, d, digits + sizeof(digits) - d);
+	return p + (digits + sizeof(digits) - d);
+}
+
+static char * format_text(char *p, char *end, const char *text, size_t length)
+{
+	if (p == NULL || (size_t)(end - p) < length)
+	{
+		return NULL;
+	}
+	memcpy(p, text, length);
+	return p + length;
+}
+
+// one participant's entry - [id,angle,talking,turns,talk time,energy,interrupts attempted,interrupts successful],
+// preceded by a comma unless it is the first
+static char * format_participant(char *p, char *end, int slot, const participant_data *participant, bool first)
+{
+	p = format_text(p, end, first ? "[" : ",[", first ? 1 : 2);
+	p = format_int(p, end, slot + 1);
+	p = format_text(p, end, ",", 1);
+	p = format_int(p, end, participant->participant_angle);
+	p = format_text(p, end, ",", 1);
+	p = format_int(p, end, participant->participant_is_talking);
+	p = format_text(p, end, ",", 1);
+	p = format_int(p, end, participant->participant_num_turns);
+	p = format_text(p, end, ",", 1);
+	p = format_int(p, end, participant->participant_total_talk_time);
+	p = format_text(p, end, ",", 1);
+	p = format_int(p, end, participant->participant_energy);
+	p = format_text(p, end, ",", 1);
+	p = format_int(p, end, participant->participant_interrupts_attempted);
+	p = format_text(p, end, ",", 1);
+	p = format_int(p, end, participant->participant_interrupts_successful);
+	return format_text(p, end, "]", 1);
+}
+
+// Same bytes as build_payload_string.  Returns the length written, not counting the terminating null, or
+// -1 if buffer is too small (buffer then holds an empty string)
+int build_payload_text(char *buffer, int size, const meeting *meeting_data, const participant_data *participant_data_array)
+{
+	char *p = buffer;
+	char *end = buffer + size - 1; // room for the null
+	bool first = true;
+	int i;
+
+	p = format_text(p, end, "{\"tMT\": ", 8);
+	p = format_int(p, end, meeting_data->total_meeting_time);
+	p = format_text(p, end, ", \"dT\": ", 8);
+	p = format_int(p, end, meeting_data->dominant_talker + 1);
+	p = format_text(p, end, ",\n\"m\": [\n", 9);
+
+	for (i = 0; i < meeting_data->num_participants; i++)
+	{
+		if (participant_data_array[i].participant_frames != 0)
+		{
+			p = format_participant(p, end, i, &participant_data_array[i], first);
+			first = false;
+		}
+	}
+
+	p = format_text(p, end, "]}\n", 3);
+
+	if (p == NULL)
+	{
+		buffer[0] = 0x00;
+		return -1;
+	}
+	*p = 0x00;
+	return p - buffer;
+}
+
+// sizes the delta state for a participant pool - returns false if it cannot be allocated
+bool payload_delta_init(payload_delta_state *state, int max_participants)
+{
+	int i;
+
+	state->version = 0;
+	state->publishes_since_keyframe = 0;
+	state->force_keyframe = true;
+	state->max_participants = max_participants;
+	state->published_participants = 0;
+	state->published_dominant_talker = NOPARTICIPANT;
+	state->published = (participant_data *)malloc(max_participants * sizeof(participant_data));
+	if (state->published == NULL)
+	{
+		return false;
+	}
+	for (i = 0; i < max_participants; i++)
+	{
+		initialise_participant(&state->published[i]);
+	}
+	return true;
+}
+
+void payload_delta_free(payload_delta_state *state)
+{
+	free(state->published);
+	state->published = NULL;
+}
+
+// the next build_payload_delta will be a keyframe - used when a new meeting starts
+void payload_delta_reset(payload_delta_state *state)
+{
+	state->force_keyframe = true;
+}
+
+static bool participant_changed(const participant_data *published, const participant_data *current)
+{
+	return (published->participant_frames == 0) != (current->participant_frames == 0) ||
+		   published->participant_is_talking != current->participant_is_talking ||
+		   published->participant_num_turns != current->participant_num_turns ||
+		   published->participant_total_talk_time != current->participant_total_talk_time ||
+		   published->participant_energy != current->participant_energy ||
+		   published->participant_interrupts_attempted != current->participant_interrupts_attempted ||
+		   published->participant_interrupts_successful != current->participant_interrupts_successful ||
+		   published->participant_angle != current->participant_angle;
+}
+
+// Returns the length written, 0 if nobody has changed and no keyframe is due (so there is nothing to send),
+// or -1 if buffer is too small
+int build_payload_delta(char *buffer, int size, payload_delta_state *state, const meeting *meeting_data, const participant_data *participant_data_array)
+{
+	char *p = buffer;
+	char *end = buffer + size - 1; // room for the null
+	bool keyframe, changed, first = true;
+	int i, slots;
+
+	keyframe = state->force_keyframe || state->version == 0 || state->publishes_since_keyframe >= KEYFRAMEINTERVAL - 1;
+
+	// every slot that is live now or was at the last payload
+	slots = meeting_data->num_participants > state->published_participants ? meeting_data->num_participants : state->published_participants;
+
+	if (!keyframe)
+	{
+		changed = state->published_dominant_talker != meeting_data->dominant_talker;
+		for (i = 0; i < slots && !keyframe; i++)
+		{
+			// "d" has no way of saying someone has gone, so that takes a keyframe
+			keyframe = state->published[i].participant_frames != 0 && participant_data_array[i].participant_frames == 0;
+			changed = changed || participant_changed(&state->published[i], &participant_data_array[i]);
+		}
+		if (!keyframe && !changed)
+		{
+			return 0;
+		}
+	}
+
+	p = format_text(p, end, "{\"v\": ", 6);
+	p = format_int(p, end, (int)++state->version);
+	p = format_text(p, end, ", \"tMT\": ", 9);
+	p = format_int(p, end, meeting_data->total_meeting_time);
+	p = format_text(p, end, ", \"dT\": ", 8);
+	p = format_int(p, end, meeting_data->dominant_talker + 1);
+	p = format_text(p, end, keyframe ? ",\n\"m\": [\n" : ",\n\"d\": [\n", 9);
+
+	for (i = 0; i < meeting_data->num_participants; i++)
+	{
+		if (participant_data_array[i].participant_frames == 0 ||
+			(!keyframe && !participant_changed(&state->published[i], &participant_data_array[i])))
+		{
+			continue;
+		}
+
+		p = format_participant(p, end, i, &participant_data_array[i], first);
+		first = false;
+	}
+
+	p = format_text(p, end, "]}\n", 3);
+
+	if (p == NULL)
+	{
+		// the clients may now be out of step with published[] so make sure they get a keyframe next
+		state->force_keyframe = true;
+		buffer[0] = 0x00;
+		return -1;
+	}
+
+	memcpy(state->published, participant_data_array, slots * sizeof(participant_data));
+	state->published_participants = meeting_data->num_participants;
+	state->published_dominant_talker = meeting_data->dominant_talker;
+
+	if (keyframe)
+	{
+		state->publishes_since_keyframe = 0;
+		state->force_keyframe = false;
+	}
+	else
+	{
+		++state->publishes_since_keyframe;
+	}
+
+	*p = 0x00;
+	return p - buffer;
+}
+
+static unsigned char * encode_varint(unsigned char *p, unsigned int value)
+{
+	while (value >= 0x80)
+	{
+		*p++ = (unsigned char)(value | 0x80);
+		value >>= 7;
+	}
+	*p++ = (unsigned char)value;
+	return p;
+}
+
+// the meeting state at full precision - schema, participant count, dominant talker, meeting time and then each live
+// participant.  raw needs room for BINARYRAWSIZE bytes.  Returns the length written
+int build_payload_raw(unsigned char *raw, const meeting *meeting_data, const participant_data *participant_data_array)
+{
+	unsigned char *p = raw;
+	unsigned int packed;
+	int i, num_participants = 0;
+
+	*p++ = RAWSCHEMA;
+	*p++ = 0; // the count goes in once we know it
+	*p++ = (unsigned char)(meeting_data->dominant_talker + 1);
+	p = encode_varint(p, meeting_data->total_meeting_time);
+
+	for (i = 0; i < meeting_data->num_participants && i < MAXPOOL; i++)
+	{
+		if (participant_data_array[i].participant_frames == 0)
+		{
+			continue;
+		}
+
+		++num_participants;
+		*p++ = (unsigned char)(i + 1);
+		packed = (participant_data_array[i].participant_angle & 0x1ff) | (participant_data_array[i].participant_is_talking != 0 ? 0x200 : 0);
+		*p++ = (unsigned char)(packed & 0xff);
+		*p++ = (unsigned char)(packed >> 8);
+		p = encode_varint(p, participant_data_array[i].participant_num_turns);
+		p = encode_varint(p, participant_data_array[i].participant_total_talk_time);
+		*p++ = (unsigned char)participant_data_array[i].participant_energy;
+		p = encode_varint(p, participant_data_array[i].participant_interrupts_attempted);
+		p = encode_varint(p, participant_data_array[i].participant_interrupts_successful);
+	}
+	raw[1] = (unsigned char)num_participants;
+	return p - raw;
+}
+
+// one live participant in four bytes, with their counts after it if they will not fit in the fourth
+static unsigned char * pack_participant(unsigned char *p, int slot, const participant_data *participant, const meeting *meeting_data)
+{
+	unsigned int packed, share, energy, turns, attempted, successful;
+	bool counts_follow;
+
+	packed = (participant->participant_angle & 0x1ff) | ((slot + 1) & 0x1f) << 9 | (participant->participant_is_talking != 0 ? 0x4000 : 0) |
+			 (slot == meeting_data->dominant_talker ? 0x8000 : 0);
+	share = meeting_data->total_meeting_time > 0 ? ((unsigned long long)participant->participant_total_talk_time * 255 +
+													meeting_data->total_meeting_time / 2) / meeting_data->total_meeting_time : 0;
+	energy = participant->participant_energy > 0 ? (participant->participant_energy * 7 + 50) / 100 : 0;
+	turns = participant->participant_num_turns;
+	attempted = participant->participant_interrupts_attempted;
+	successful = participant->participant_interrupts_successful;
+	counts_follow = turns > 6 || attempted > 1 || successful > 1;
+
+	*p++ = (unsigned char)(packed & 0xff);
+	*p++ = (unsigned char)(packed >> 8);
+	*p++ = (unsigned char)(share < 255 ? share : 255);
+	*p++ = (unsigned char)((energy < 7 ? energy : 7) | (counts_follow ? 7 << 3 : turns << 3 | attempted << 6 | successful << 7));
+	if (counts_follow)
+	{
+		p = encode_varint(p, turns);
+		p = encode_varint(p, attempted);
+		p = encode_varint(p, successful);
+	}
+	return p;
+}
+
+// Returns the length written, not counting the terminating null, or -1 if buffer is too small
+int build_payload_binary(char *buffer, int size, const meeting *meeting_data, const participant_data *participant_data_array)
+{
+	unsigned char raw[BINARYRAWSIZE];
+	unsigned char *p = raw;
+	unsigned char *code, *out, *out_end;
+	int i;
+
+	*p++ = BINARYSCHEMA;
+	p = encode_varint(p, meeting_data->total_meeting_time);
+	for (i = 0; i < meeting_data->num_participants && i < MAXPOOL; i++)
+	{
+		if (participant_data_array[i].participant_frames != 0)
+		{
+			p = pack_participant(p, i, &participant_data_array[i], meeting_data);
+		}
+	}
+
+	// COBS - every zero is replaced by the distance to the next one, held in a code byte in front of each run
+	out = (unsigned char *)buffer;
+	out_end = out + size - 1; // room for the null
+	code = out++;
+	*code = 1;
+	for (unsigned char *in = raw; in < p; in++)
+	{
+		if (out >= out_end)
+		{
+			buffer[0] = 0x00;
+			return -1;
+		}
+		if (*in != 0x00)
+		{
+			*out++ = *in;
+			++*code;
+		}
+		if (*in == 0x00 || *code == 0xff)
+		{
+			code = out++;
+			*code = 1;
+		}
+	}
+	if (out > out_end)
+	{
+		buffer[0] = 0x00;
+		return -1;
+	}
+
+	*out = 0x00;
+	return out - (unsigned char *)buffer;
+}
@@ -0,0 +1,283 @@
+//
+//  recording.cpp
+//
+//  the datagram recorder and its reader.  The ingest thread copies each datagram into the buffer at
+//  the head of a small spsc queue and moves head on when it is full, or has been waiting for more than
+//  RECORDINGFLUSHUS - checked as each datagram arrives and on the ingest thread's timeout.  The writer
+//  thread sleeps on an eventfd and appends each buffer it is handed.  Replay maps the file and walks
+//  it frame by frame
+//
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <time.h>
+
+#include "../include/recording.h"
+
+
+static long long monotonic_us()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+// starts a new recording, replacing anything already called filename
+bool recording_open_writer(recording_writer *recording, const char *filename)
+{
+	unsigned char header[RECORDINGHEADER];
+	uint32_t magic = RECORDINGMAGIC, version = RECORDINGVERSION;
+	struct timespec now;
+	uint64_t started_us;
+	int i;
+
+	recording->head.store(0);
+	recording->tail.store(0);
+	recording->stopping.store(false);
+	recording->last_us = 0;
+	recording->filled_us = 0;
+	recording->filling = false;
+	recording->frames = 0;
+	recording->bytes = 0;
+	recording->dropped.store(0);
+	recording->failed.store(0);
+	recording->max_write_us.store(0);
+	recording->wake_fd = -1;
+	for (i = 0; i < RECORDINGQUEUE; i++)
+	{
+		recording->buffer[i].used = 0;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	started_us = now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+	memcpy(header, &magic, 4);
+	memcpy(header + 4, &version, 4);
+	memcpy(header + 8, &started_us, 8);
+
+	if ((recording->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0 ||
+		write(recording->fd, header, RECORDINGHEADER) != RECORDINGHEADER)
+	{
+		return false;
+	}
+	recording->wake_fd = eventfd(0, EFD_CLOEXEC);
+	return recording->wake_fd >= 0;
+}
+
+void recording_close_writer(recording_writer *recording)
+{
+	if (recording->fd >= 0)
+	{
+		fdatasync(recording->fd);
+		close(recording->fd);
+	}
+	if (recording->wake_fd >= 0)
+	{
+		close(recording->wake_fd);
+	}
+}
+
+// ingest side - hands the buffer at head to the writer if there is anything in it.  Once the ingest thread has been
+// joined whoever joined it may call this to push out the last of the recording
+void recording_flush(recording_writer *recording)
+{
+	unsigned int head = recording->head.load(std::memory_order_relaxed);
+	uint64_t wake = 1;
+
+	if (recording->filling)
+	{
+		recording->head.store(head + 1, std::memory_order_release);
+		recording->filling = false;
+		write(recording->wake_fd, &wake, sizeof(wake));
+	}
+}
+
+// ingest side - hands the buffer at head to the writer if its first datagram has waited RECORDINGFLUSHUS, so a pause
+// in odas does not leave the last of the recording sitting in memory
+void recording_flush_due(recording_writer *recording)
+{
+	if (recording->filling && monotonic_us() - recording->filled_us > RECORDINGFLUSHUS)
+	{
+		recording_flush(recording);
+	}
+}
+
+// ingest side - appends a datagram as it came off the socket.  If the writer is a whole queue behind it is dropped
+// and counted, and the next one that is kept carries the time since the last one that was
+void recording_add(recording_writer *recording, const char *datagram, int length)
+{
+	long long now = monotonic_us();
+	uint32_t gap_us = recording->frames == 0 ? 0 : (now - recording->last_us > UINT32_MAX ? UINT32_MAX : now - recording->last_us);
+	uint16_t frame_length = length;
+	recording_buffer *buffer = &recording->buffer[recording->head.load(std::memory_order_relaxed) & (RECORDINGQUEUE - 1)];
+
+	if (recording->filling && (buffer->used + RECORDINGFRAMEHEADER + length > RECORDINGBUFFER || now - recording->filled_us > RECORDINGFLUSHUS))
+	{
+		recording_flush(recording);
+		buffer = &recording->buffer[recording->head.load(std::memory_order_relaxed) & (RECORDINGQUEUE - 1)];
+	}
+	if (!recording->filling)
+	{
+		// the buffer at head is only ours once the writer has moved tail past it
+		if (recording->head.load(std::memory_order_relaxed) - recording->tail.load(std::memory_order_acquire) >= RECORDINGQUEUE)
+		{
+			recording->dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		buffer->used = 0;
+		recording->filled_us = now;
+		recording->filling = true;
+	}
+
+	memcpy(buffer->data + buffer->used, &frame_length, 2);
+	memcpy(buffer->data + buffer->used + 2, &gap_us, 4);
+	memcpy(buffer->data + buffer->used + RECORDINGFRAMEHEADER, datagram, length);
+	buffer->used += RECORDINGFRAMEHEADER + length;
+	recording->last_us = now;
+	++recording->frames;
+	recording->bytes += length;
+}
+
+// the writer thread.  Once stopped it still writes whatever was queued before returning
+void recording_writer_run(recording_writer *recording)
+{
+	unsigned int tail;
+	uint64_t wakes;
+	recording_buffer *buffer;
+	long long start, elapsed;
+	int written, bytes;
+
+	for (;;)
+	{
+		while ((tail = recording->tail.load(std::memory_order_relaxed)) != recording->head.load(std::memory_order_acquire))
+		{
+			buffer = &recording->buffer[tail & (RECORDINGQUEUE - 1)];
+			start = monotonic_us();
+
+			written = 0;
+			while (written < buffer->used && (bytes = write(recording->fd, buffer->data + written, buffer->used - written)) > 0)
+			{
+				written += bytes;
+			}
+			if (written != buffer->used)
+			{
+				recording->failed.fetch_add(1, std::memory_order_relaxed);
+			}
+			recording->tail.store(tail + 1, std::memory_order_release);
+
+			elapsed = monotonic_us() - start;
+			if (elapsed > recording->max_write_us.load(std::memory_order_relaxed))
+			{
+				recording->max_write_us.store(elapsed, std::memory_order_relaxed);
+			}
+		}
+
+		if (recording->stopping.load(std::memory_order_acquire))
+		{
+			return;
+		}
+		read(recording->wake_fd, &wakes, sizeof(wakes));
+	}
+}
+
+// any thread - the writer finishes what is queued and returns
+void recording_stop(recording_writer *recording)
+{
+	uint64_t wake = 1;
+
+	recording->stopping.store(true, std::memory_order_release);
+	write(recording->wake_fd, &wake, sizeof(wake));
+}
+
+//
+// Replay
+//
+
+// whether a file in a directory of recordings is one of the things kept beside them - labels, config files and notes -
+// rather than a recording that failed to open
+bool recording_sidecar(const char *filename)
+{
+	static const char *suffixes[] = {LABELSUFFIX, ".conf", ".txt", ".md", ".log"};
+	size_t length = strlen(filename), suffix, i;
+
+	for (i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++)
+	{
+		suffix = strlen(suffixes[i]);
+		if (length >= suffix && strcmp(filename + length - suffix, suffixes[i]) == 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+// maps a recording for replay
+bool recording_open(recording_reader *reader, const char *filename)
+{
+	struct stat file_stat;
+	uint32_t magic, version;
+	void *base;
+
+	reader->base = NULL;
+	reader->size = 0;
+	reader->offset = RECORDINGHEADER;
+	if ((reader->fd = open(filename, O_RDONLY | O_CLOEXEC)) < 0)
+	{
+		return false;
+	}
+	if (fstat(reader->fd, &file_stat) < 0 || file_stat.st_size < RECORDINGHEADER ||
+		(base = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, reader->fd, 0)) == MAP_FAILED)
+	{
+		close(reader->fd);
+		return false;
+	}
+	reader->base = (const unsigned char *)base;
+	reader->size = file_stat.st_size;
+	madvise(base, reader->size, MADV_SEQUENTIAL);
+
+	memcpy(&magic, reader->base, 4);
+	memcpy(&version, reader->base + 4, 4);
+	memcpy(&reader->started_us, reader->base + 8, 8);
+	if (magic != RECORDINGMAGIC || version != RECORDINGVERSION)
+	{
+		recording_close(reader);
+		return false;
+	}
+	return true;
+}
+
+void recording_close(recording_reader *reader)
+{
+	if (reader->base != NULL)
+	{
+		munmap((void *)reader->base, reader->size);
+	}
+	close(reader->fd);
+	reader->base = NULL;
+}
+
+// the next datagram, which is not null terminated, and the microseconds since the one before it.  Returns false at the
+// end of the recording, including a frame cut short by the recorder being killed mid write
+bool recording_next(recording_reader *reader, const char **datagram, int *length, uint32_t *gap_us)
+{
+	uint16_t frame_length;
+
+	if (reader->offset + RECORDINGFRAMEHEADER > reader->size)
+	{
+		return false;
+	}
+	memcpy(&frame_length, reader->base + reader->offset, 2);
+	if (reader->offset + RECORDINGFRAMEHEADER + frame_length > reader->size)
+	{
+		return false;
+	}
+	memcpy(gap_us, reader->base + reader->offset + 2, 4);
+	*datagram = (const char *)reader->base + reader->offset + RECORDINGFRAMEHEADER;
+	*length = frame_length;
+	reader->offset += RECORDINGFRAMEHEADER + frame_length;
+	return true;
+}
@@ -0,0 +1,48 @@
+//
+//  snapshot.cpp
+//
+//  classic triple buffer.  The writer fills its back buffer and swaps it into the middle; the reader
+//  swaps the middle out for its front buffer when there is something new.  Each side owns one buffer
+//  outright at all times, so the reader's payload stays complete and unchanged until its next read
+//
+
+#include "../include/snapshot.h"
+
+#define SNAPSHOTFRESH 0x4
+
+
+void snapshot_init(payload_snapshot *snapshot)
+{
+	int i;
+
+	for (i = 0; i < 3; i++)
+	{
+		snapshot->buffer[i].text[0] = 0x00;
+		snapshot->buffer[i].length = 0;
+	}
+	snapshot->back = 0;
+	snapshot->middle.store(1);
+	snapshot->front = 2;
+}
+
+// writer side - the buffer to fill in before calling snapshot_publish
+payload_buffer * snapshot_write_buffer(payload_snapshot *snapshot)
+{
+	return &snapshot->buffer[snapshot->back];
+}
+
+// writer side - makes the back buffer the latest payload and takes the old middle buffer to write into next
+void snapshot_publish(payload_snapshot *snapshot)
+{
+	snapshot->back = snapshot->middle.exchange(snapshot->back | SNAPSHOTFRESH, std::memory_order_acq_rel) & ~SNAPSHOTFRESH;
+}
+
+// reader side - the most recent complete payload.  It belongs to the reader until it calls this again
+const payload_buffer * snapshot_read(payload_snapshot *snapshot)
+{
+	if (snapshot->middle.load(std::memory_order_relaxed) & SNAPSHOTFRESH)
+	{
+		snapshot->front = snapshot->middle.exchange(snapshot->front, std::memory_order_acq_rel) & ~SNAPSHOTFRESH;
+	}
+	return &snapshot->buffer[snapshot->front];
+}
@@ -0,0 +1,94 @@
+//
+//  tuning.cpp
+//
+//  the config file is a "name value" line for each threshold, in any order, with # starting a
+//  comment.  Anything left out keeps its default, and anything not understood is an error rather
+//  than being quietly ignored, as a misspelt threshold would otherwise look like it had been set
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#include "../include/tuning.h"
+
+
+// a threshold's value if it is in range.  Returns false if it is not one we know or the value will not do
+static bool set_threshold(meeting_tuning *tuning, const char *name, double value)
+{
+	if (strcmp(name, "min_energy") == 0 && value >= 0.0 && value <= 1.0)
+	{
+		tuning->min_energy = value;
+	}
+	else if (strcmp(name, "angle_spread") == 0 && value > 0.0 && value <= 180.0)
+	{
+		tuning->angle_spread = value;
+	}
+	else if (strcmp(name, "min_talk_time") == 0 && value >= 0 && value <= TALKERWINDOW && value == (int)value)
+	{
+		tuning->min_talk_time = value;
+	}
+	else if (strcmp(name, "max_silence") == 0 && value >= 1 && value <= INT_MAX && value == (int)value)
+	{
+		tuning->max_silence = value;
+	}
+	else
+	{
+		return false;
+	}
+	return true;
+}
+
+// reads a config file over tuning.  Returns 0 if it was all understood, -1 if the file could not be opened, or the
+// number of the first line that was not understood - in which case tuning is left as it was
+int tuning_load(meeting_tuning *tuning, const char *filename)
+{
+	FILE *file = fopen(filename, "r");
+	meeting_tuning loaded = *tuning;
+	char line[MAXLINE], name[MAXLINE], extra[MAXLINE];
+	char *comment;
+	double value;
+	int line_number = 0, fields;
+
+	if (file == NULL)
+	{
+		return -1;
+	}
+	while (fgets(line, sizeof(line), file) != NULL)
+	{
+		++line_number;
+		if ((comment = strchr(line, '#')) != NULL)
+		{
+			*comment = 0x00;
+		}
+		fields = sscanf(line, "%s %lf %s", name, &value, extra);
+		if (fields != EOF && (fields != 2 || !set_threshold(&loaded, name, value)))
+		{
+			fclose(file);
+			return line_number;
+		}
+	}
+	fclose(file);
+
+	*tuning = loaded;
+	return 0;
+}
+
+// writes tuning out as a config file, with comment (which may be NULL) at the top
+bool tuning_save(const meeting_tuning *tuning, const char *filename, const char *comment)
+{
+	FILE *file = fopen(filename, "w");
+	bool ok;
+
+	if (file == NULL)
+	{
+		return false;
+	}
+	if (comment != NULL)
+	{
+		fprintf(file, "# %s\n", comment);
+	}
+	fprintf(file, "min_energy %g\nangle_spread %g\nmin_talk_time %d\nmax_silence %d\n", tuning->min_energy, tuning->angle_spread,
+			tuning->min_talk_time, tuning->max_silence);
+	ok = !ferror(file);
+	return fclose(file) == 0 && ok;
+}